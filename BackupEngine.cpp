@@ -0,0 +1,420 @@
+/*
+   Copyright (c) 2021 Christof Ruch. All rights reserved.
+
+   Dual licensed: Distributed under Affero GPL license by default, an MIT license is available for purchase
+*/
+
+#include "BackupEngine.h"
+#include "BackupRetention.h"
+
+#include "Logger.h"
+
+#include "SQLiteCpp/Database.h"
+#include "SQLiteCpp/Backup.h"
+
+#include "SQLiteCpp/../../sqlite3/sqlite3.h"
+
+#include "fmt/format.h"
+
+namespace midikraft {
+
+	// Pages copied per step of the online backup, the source is locked only for the duration of one step
+	const int kBackupPagesPerStep = 256;
+	const int kBackupBusyPauseMs = 50;
+	// Size of the blocks a deduplicated backup is cut into. A multiple of every SQLite page size, so a changed page only changes one block
+	const int kBackupBlockSize = 65536;
+	// Attempts to get a stable database file for the block reader before falling back to copying the database first
+	const int kBlockReadAttempts = 5;
+
+	const String kManifestHeader = "MidiKraft backup blocks 1";
+	const String kManifestExtension = ".blocks";
+	const String kCompressedExtension = ".gz";
+	const String kPartialExtension = ".partial";
+
+	BackupEngine::BackupEngine() : Thread("DatabaseBackups"), idle_(true)
+	{
+		idle_.signal();
+		startThread();
+	}
+
+	BackupEngine::~BackupEngine()
+	{
+		{
+			ScopedLock lock(lock_);
+			stopping_ = true;
+		}
+		queueChanged_.signal();
+		// Don't use stopThread, that would ask the running backup to exit. The queue is finished first
+		waitForThreadToExit(-1);
+	}
+
+	void BackupEngine::queueBackup(File databaseFile, String suffix, BackupFormat format)
+	{
+		{
+			ScopedLock lock(lock_);
+			queue_.push_back({ databaseFile, suffix, format });
+			idle_.reset();
+		}
+		queueChanged_.signal();
+	}
+
+	void BackupEngine::queueTask(std::function<void()> task)
+	{
+		{
+			ScopedLock lock(lock_);
+			Job job;
+			job.task = task;
+			queue_.push_back(job);
+			idle_.reset();
+		}
+		queueChanged_.signal();
+	}
+
+	void BackupEngine::waitForQueuedBackups()
+	{
+		idle_.wait(-1);
+	}
+
+	void BackupEngine::run()
+	{
+		while (true) {
+			Job job;
+			bool hasJob = false;
+			{
+				ScopedLock lock(lock_);
+				if (queue_.empty()) {
+					idle_.signal();
+					if (stopping_) {
+						return;
+					}
+				}
+				else {
+					job = queue_.front();
+					queue_.pop_front();
+					hasJob = true;
+				}
+			}
+			if (!hasJob) {
+				queueChanged_.wait(1000);
+			}
+			else if (job.task) {
+				job.task();
+			}
+			else {
+				makeBackup(job);
+			}
+		}
+	}
+
+	void BackupEngine::makeBackup(Job const& job)
+	{
+		double startTime = Time::getMillisecondCounterHiRes();
+		File dbFile = job.databaseFile;
+		String extension = dbFile.getFileExtension();
+		bool success = false;
+		File backupFile;
+		switch (job.format) {
+		case BackupFormat::Plain: {
+			backupFile = dbFile.getParentDirectory().getNonexistentChildFile(dbFile.getFileNameWithoutExtension() + job.suffix, extension, false);
+			File partial = backupFile.getSiblingFile(backupFile.getFileName() + kPartialExtension);
+			success = steppedCopy(dbFile, partial) && partial.moveFileTo(backupFile);
+			partial.deleteFile();
+			break;
+		}
+		case BackupFormat::Compressed: {
+			backupFile = dbFile.getParentDirectory().getNonexistentChildFile(dbFile.getFileNameWithoutExtension() + job.suffix, extension + kCompressedExtension, false);
+			File partial = backupFile.getSiblingFile(backupFile.getFileName() + kPartialExtension);
+			TemporaryFile copy(dbFile);
+			success = steppedCopy(dbFile, copy.getFile()) && compress(copy.getFile(), partial) && partial.moveFileTo(backupFile);
+			partial.deleteFile();
+			break;
+		}
+		case BackupFormat::Deduplicated:
+			backupFile = dbFile.getParentDirectory().getNonexistentChildFile(dbFile.getFileNameWithoutExtension() + job.suffix, extension + kManifestExtension, false);
+			success = writeBlocks(dbFile, backupFile);
+			if (success) {
+				collectGarbage(dbFile);
+			}
+			break;
+		}
+		if (success) {
+			BackupRetention(dbFile, job.suffix).recordBackup(backupFile);
+			SimpleLogger::instance()->postMessage(fmt::format("Created database backup {} in {:.1f} s", backupFile.getFileName().toStdString(), (Time::getMillisecondCounterHiRes() - startTime) / 1000.0));
+		}
+		else {
+			backupFile.deleteFile();
+			SimpleLogger::instance()->postMessage("Error - failed to create database backup " + backupFile.getFullPathName());
+		}
+	}
+
+	bool BackupEngine::steppedCopy(File databaseFile, File copyToCreate)
+	{
+		try {
+			SQLite::Database source(databaseFile.getFullPathName().toStdString(), SQLite::OPEN_READONLY);
+			SQLite::Database destination(copyToCreate.getFullPathName().toStdString(), SQLite::OPEN_READWRITE | SQLite::OPEN_CREATE);
+			SQLite::Backup backup(destination, source);
+			// A write through another connection restarts the backup, but a step is short enough for that to be rare
+			int result;
+			do {
+				result = backup.executeStep(kBackupPagesPerStep);
+				if (result == SQLITE_BUSY || result == SQLITE_LOCKED) {
+					Thread::sleep(kBackupBusyPauseMs);
+				}
+				else {
+					Thread::yield();
+				}
+			} while (result != SQLITE_DONE);
+			return true;
+		}
+		catch (SQLite::Exception& ex) {
+			SimpleLogger::instance()->postMessage(fmt::format("DATABASE ERROR in backup: SQL Exception {}", ex.what()));
+		}
+		return false;
+	}
+
+	bool BackupEngine::compress(File source, File gzipToCreate)
+	{
+		FileInputStream in(source);
+		if (!in.openedOk()) {
+			return false;
+		}
+		{
+			// FileOutputStream appends to an existing file, like the leftover of an interrupted backup
+			gzipToCreate.deleteFile();
+			auto fileStream = std::make_unique<FileOutputStream>(gzipToCreate);
+			if (!fileStream->openedOk()) {
+				return false;
+			}
+			GZIPCompressorOutputStream out(fileStream.release(), 9, true, GZIPCompressorOutputStream::windowBitsGZIP);
+			if (out.writeFromInputStream(in, -1) != source.getSize()) {
+				return false;
+			}
+			out.flush();
+		}
+		return true;
+	}
+
+	File BackupEngine::blockDirectory(File databaseFile)
+	{
+		return databaseFile.getParentDirectory().getChildFile(databaseFile.getFileNameWithoutExtension() + "-blocks");
+	}
+
+	bool BackupEngine::writeBlocks(File databaseFile, File manifestToCreate)
+	{
+		File blocks = blockDirectory(databaseFile);
+		if (!blocks.createDirectory()) {
+			return false;
+		}
+		try {
+			// Read the database file itself when it is known to contain the full content of a read transaction. In rollback journal mode, the read transaction keeps writers out.
+			// In WAL mode, everything must have been checkpointed into the file, and then the read transaction keeps the checkpointer from writing newer pages into it.
+			// No commit may happen between the checkpoint and the start of the read, which data_version tells
+			SQLite::Database source(databaseFile.getFullPathName().toStdString(), SQLite::OPEN_READWRITE);
+			bool stable = false;
+			for (int attempt = 0; attempt < kBlockReadAttempts && !stable; attempt++) {
+				int64 versionBefore = source.execAndGet("PRAGMA data_version").getInt64();
+				bool complete;
+				{
+					// Returns busy, frames in the log and frames checkpointed, the latter two are -1 outside of WAL mode
+					SQLite::Statement checkpoint(source, "PRAGMA wal_checkpoint(PASSIVE)");
+					checkpoint.executeStep();
+					complete = checkpoint.getColumn(0).getInt() == 0 && checkpoint.getColumn(1).getInt() == checkpoint.getColumn(2).getInt();
+				}
+				source.exec("BEGIN");
+				source.execAndGet("SELECT count(*) FROM sqlite_master");
+				stable = complete && source.execAndGet("PRAGMA data_version").getInt64() == versionBefore;
+				if (!stable) {
+					source.exec("ROLLBACK");
+					Thread::sleep(kBackupBusyPauseMs);
+				}
+			}
+
+			File blockSource = databaseFile;
+			std::unique_ptr<TemporaryFile> staging;
+			if (!stable) {
+				// The database is busy, copy it first. This costs a full write again, but still only stores the changed blocks
+				staging = std::make_unique<TemporaryFile>(databaseFile);
+				if (!steppedCopy(databaseFile, staging->getFile())) {
+					return false;
+				}
+				blockSource = staging->getFile();
+			}
+
+			FileInputStream in(blockSource);
+			if (!in.openedOk()) {
+				return false;
+			}
+			String manifest = kManifestHeader + "\n" + blocks.getFileName() + "\n" + String(in.getTotalLength()) + "\n";
+			HeapBlock<uint8> buffer(kBackupBlockSize);
+			while (!in.isExhausted()) {
+				int bytesRead = in.read(buffer.getData(), kBackupBlockSize);
+				if (bytesRead <= 0) {
+					break;
+				}
+				String hash = SHA256(buffer.getData(), (size_t)bytesRead).toHexString();
+				File block = blocks.getChildFile(hash);
+				if (!block.existsAsFile()) {
+					File partial = block.getSiblingFile(hash + kPartialExtension);
+					if (!partial.replaceWithData(buffer.getData(), (size_t)bytesRead) || !partial.moveFileTo(block)) {
+						return false;
+					}
+				}
+				manifest += hash + "\n";
+			}
+			if (stable) {
+				source.exec("ROLLBACK");
+			}
+
+			File partialManifest = manifestToCreate.getSiblingFile(manifestToCreate.getFileName() + kPartialExtension);
+			if (!partialManifest.replaceWithText(manifest, false, false, "\n") || !partialManifest.moveFileTo(manifestToCreate)) {
+				return false;
+			}
+			return true;
+		}
+		catch (SQLite::Exception& ex) {
+			SimpleLogger::instance()->postMessage(fmt::format("DATABASE ERROR in backup: SQL Exception {}", ex.what()));
+		}
+		return false;
+	}
+
+	bool BackupEngine::readManifest(File manifest, File& outBlockDirectory, std::vector<String>& outBlocks, int64& outSize)
+	{
+		// Header line, name of the block directory next to the manifest, file size, then one block hash per line
+		StringArray lines;
+		manifest.readLines(lines);
+		lines.removeEmptyStrings();
+		if (lines.size() < 3 || lines[0] != kManifestHeader) {
+			return false;
+		}
+		outBlockDirectory = manifest.getSiblingFile(lines[1].trim());
+		outSize = lines[2].getLargeIntValue();
+		outBlocks.clear();
+		for (int i = 3; i < lines.size(); i++) {
+			outBlocks.push_back(lines[i].trim());
+		}
+		return true;
+	}
+
+	bool BackupEngine::hasChangesSinceLastBackup(File databaseFile, String suffix)
+	{
+		auto backups = databaseFile.getParentDirectory().findChildFiles(File::TypesOfFileToFind::findFiles, false, databaseFile.getFileNameWithoutExtension() + suffix + "*" + databaseFile.getFileExtension() + "*");
+		Time newestBackup(0);
+		for (auto const& backup : backups) {
+			if (!isIncomplete(backup)) {
+				newestBackup = std::max(newestBackup, backup.getLastModificationTime());
+			}
+		}
+		if (newestBackup == Time(0)) {
+			return true;
+		}
+		Time lastWrite = databaseFile.getLastModificationTime();
+		// The write ahead log exists as long as a connection is open, but only has content after a write
+		File wal(databaseFile.getFullPathName() + "-wal");
+		if (wal.getSize() > 0) {
+			lastWrite = std::max(lastWrite, wal.getLastModificationTime());
+		}
+		return lastWrite > newestBackup;
+	}
+
+	int64 BackupEngine::backupSize(File backupFile)
+	{
+		if (backupFile.hasFileExtension(kManifestExtension)) {
+			File blocks;
+			std::vector<String> blockNames;
+			int64 size;
+			if (readManifest(backupFile, blocks, blockNames, size)) {
+				return size;
+			}
+		}
+		return backupFile.getSize();
+	}
+
+	bool BackupEngine::isIncomplete(File backupFile)
+	{
+		return backupFile.hasFileExtension(kPartialExtension);
+	}
+
+	bool BackupEngine::restoreBackup(File backupFile, File databaseFileToCreate)
+	{
+		if (databaseFileToCreate.exists()) {
+			jassertfalse;
+			return false;
+		}
+		if (backupFile.hasFileExtension(kCompressedExtension)) {
+			auto fileStream = std::make_unique<FileInputStream>(backupFile);
+			if (!fileStream->openedOk()) {
+				return false;
+			}
+			GZIPDecompressorInputStream in(fileStream.release(), true, GZIPDecompressorInputStream::gzipFormat);
+			auto out = std::make_unique<FileOutputStream>(databaseFileToCreate);
+			if (!out->openedOk()) {
+				return false;
+			}
+			out->writeFromInputStream(in, -1);
+			out->flush();
+			bool ok = out->getStatus().wasOk();
+			// Close the file before deleting it, it is still open on Windows otherwise
+			out.reset();
+			if (!ok) {
+				databaseFileToCreate.deleteFile();
+			}
+			return ok;
+		}
+		else if (backupFile.hasFileExtension(kManifestExtension)) {
+			File blocks;
+			std::vector<String> blockNames;
+			int64 size;
+			if (!readManifest(backupFile, blocks, blockNames, size)) {
+				return false;
+			}
+			auto out = std::make_unique<FileOutputStream>(databaseFileToCreate);
+			if (!out->openedOk()) {
+				return false;
+			}
+			bool ok = true;
+			for (auto const& name : blockNames) {
+				FileInputStream block(blocks.getChildFile(name));
+				if (!block.openedOk()) {
+					SimpleLogger::instance()->postMessage("Error - backup block missing: " + name);
+					ok = false;
+					break;
+				}
+				out->writeFromInputStream(block, -1);
+			}
+			out->flush();
+			ok = ok && out->getStatus().wasOk() && out->getPosition() == size;
+			// Close the file before deleting the partial restore, it is still open on Windows otherwise
+			out.reset();
+			if (!ok) {
+				databaseFileToCreate.deleteFile();
+			}
+			return ok;
+		}
+		else {
+			return backupFile.copyFileTo(databaseFileToCreate);
+		}
+	}
+
+	void BackupEngine::collectGarbage(File databaseFile)
+	{
+		// Keep every block referenced by a manifest of this database. The pattern also matches manifests of databases with a longer name,
+		// which can only keep more blocks than necessary
+		std::set<String> referenced;
+		for (auto const& manifest : databaseFile.getParentDirectory().findChildFiles(File::TypesOfFileToFind::findFiles, false, databaseFile.getFileNameWithoutExtension() + "*" + kManifestExtension)) {
+			File blocks;
+			std::vector<String> blockNames;
+			int64 size;
+			if (!readManifest(manifest, blocks, blockNames, size)) {
+				// Can't tell which blocks this one needs, better keep all
+				return;
+			}
+			referenced.insert(blockNames.begin(), blockNames.end());
+		}
+		for (auto const& block : blockDirectory(databaseFile).findChildFiles(File::TypesOfFileToFind::findFiles, false)) {
+			if (referenced.find(block.getFileName()) == referenced.end()) {
+				block.deleteFile();
+			}
+		}
+	}
+
+}
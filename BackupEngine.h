@@ -0,0 +1,75 @@
+/*
+   Copyright (c) 2021 Christof Ruch. All rights reserved.
+
+   Dual licensed: Distributed under Affero GPL license by default, an MIT license is available for purchase
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+
+#include <deque>
+#include <set>
+
+namespace midikraft {
+
+	enum class BackupFormat {
+		Plain, // A copy of the database file, can be opened directly
+		Compressed, // The copy gzipped, as <name>.db3.gz
+		Deduplicated // A manifest <name>.db3.blocks listing the blocks of the file, which are stored once in a shared block directory next to the database
+	};
+
+	// Makes database backups on a background thread, so closing or switching a database does not wait for the copy.
+	// The copy is made through a connection of its own with the SQLite online backup API in small steps, so a writer on the database is only blocked for one step at a time.
+	// Deduplicated backups only write the blocks that changed since any previous backup, so their cost follows the amount of change and not the database size.
+	// The destructor waits for all queued backups to complete.
+	class BackupEngine : private Thread {
+	public:
+		BackupEngine();
+		virtual ~BackupEngine() override;
+
+		void queueBackup(File databaseFile, String suffix, BackupFormat format);
+		// Runs other housekeeping on the backup thread, in order with the backups. It must not use a connection of the caller
+		void queueTask(std::function<void()> task);
+		void waitForQueuedBackups();
+
+		// True if neither a backup with the suffix exists nor one newer than the last write to the database file or its write ahead log,
+		// e.g. when the previous session ended before it could make its backup
+		static bool hasChangesSinceLastBackup(File databaseFile, String suffix);
+
+		// The size of the database a backup restores, which for a deduplicated backup is more than the manifest itself
+		static int64 backupSize(File backupFile);
+		// Leftover of a backup interrupted while being written
+		static bool isIncomplete(File backupFile);
+
+		// Turns a backup of any format back into a database file
+		static bool restoreBackup(File backupFile, File databaseFileToCreate);
+
+		// Removes the blocks no longer referenced by any manifest, e.g. after the retention deleted old backups
+		static void collectGarbage(File databaseFile);
+
+	private:
+		struct Job {
+			File databaseFile;
+			String suffix;
+			BackupFormat format = BackupFormat::Plain;
+			std::function<void()> task; // Instead of a backup, if set
+		};
+
+		void run() override;
+		void makeBackup(Job const& job);
+
+		static bool steppedCopy(File databaseFile, File copyToCreate);
+		static bool compress(File source, File gzipToCreate);
+		static bool writeBlocks(File databaseFile, File manifestToCreate);
+		static File blockDirectory(File databaseFile);
+		static bool readManifest(File manifest, File &outBlockDirectory, std::vector<String>& outBlocks, int64& outSize);
+
+		std::deque<Job> queue_;
+		bool stopping_ = false;
+		CriticalSection lock_;
+		WaitableEvent queueChanged_;
+		WaitableEvent idle_;
+	};
+
+}
@@ -0,0 +1,188 @@
+/*
+   Copyright (c) 2021 Christof Ruch. All rights reserved.
+
+   Dual licensed: Distributed under Affero GPL license by default, an MIT license is available for purchase
+*/
+
+#include "BackupRetention.h"
+
+#include "BackupEngine.h"
+#include "Logger.h"
+
+#include <algorithm>
+#include <functional>
+
+namespace midikraft {
+
+	const String kIndexHeader = "MidiKraft backup index 1";
+	const String kIndexExtension = ".index";
+	const RelativeTime kIndexMaxAge = RelativeTime::days(7);
+
+	// The index is updated from the backup thread and the thread opening the database
+	static CriticalSection sIndexLock;
+
+	BackupRetention::BackupRetention(File databaseFile, String suffix) : databaseFile_(databaseFile), suffix_(suffix)
+	{
+	}
+
+	File BackupRetention::indexFile() const
+	{
+		// Doesn't end in the database extension, so it is neither matched as a backup nor does it count as one when checking for changes
+		return databaseFile_.getSiblingFile(databaseFile_.getFileNameWithoutExtension() + suffix_ + kIndexExtension);
+	}
+
+	std::vector<BackupRetention::Backup> BackupRetention::scan() const
+	{
+		std::vector<Backup> result;
+		auto files = databaseFile_.getParentDirectory().findChildFiles(File::TypesOfFileToFind::findFiles, false, databaseFile_.getFileNameWithoutExtension() + suffix_ + "*" + databaseFile_.getFileExtension() + "*");
+		for (auto const& file : files) {
+			if (!BackupEngine::isIncomplete(file)) {
+				result.push_back({ file, BackupEngine::backupSize(file), file.getLastModificationTime() });
+			}
+		}
+		return result;
+	}
+
+	bool BackupRetention::loadIndex(std::vector<Backup>& outBackups) const
+	{
+		// Header, time of the last directory scan, then size, modification time in milliseconds and file name separated by tabs
+		StringArray lines;
+		indexFile().readLines(lines);
+		lines.removeEmptyStrings();
+		if (lines.size() < 2 || lines[0] != kIndexHeader) {
+			return false;
+		}
+		Time scanned(lines[1].getLargeIntValue());
+		if (Time::getCurrentTime() - scanned > kIndexMaxAge) {
+			return false;
+		}
+		outBackups.clear();
+		for (int i = 2; i < lines.size(); i++) {
+			StringArray fields;
+			fields.addTokens(lines[i], "\t", "");
+			if (fields.size() != 3) {
+				return false;
+			}
+			outBackups.push_back({ databaseFile_.getSiblingFile(fields[2]), fields[0].getLargeIntValue(), Time(fields[1].getLargeIntValue()) });
+		}
+		return true;
+	}
+
+	void BackupRetention::saveIndex(std::vector<Backup> const& backups) const
+	{
+		// Keep the scan time of the existing index, only a scan renews it
+		int64 scanned = Time::getCurrentTime().toMilliseconds();
+		StringArray lines;
+		indexFile().readLines(lines);
+		if (lines.size() >= 2 && lines[0] == kIndexHeader) {
+			scanned = lines[1].getLargeIntValue();
+		}
+		String content = kIndexHeader + "\n" + String(scanned) + "\n";
+		for (auto const& backup : backups) {
+			content += String(backup.size) + "\t" + String(backup.created.toMilliseconds()) + "\t" + backup.file.getFileName() + "\n";
+		}
+		if (!indexFile().replaceWithText(content, false, false, "\n")) {
+			SimpleLogger::instance()->postMessage("Error - failed to write backup index file " + indexFile().getFullPathName());
+		}
+	}
+
+	void BackupRetention::recordBackup(File backupFile)
+	{
+		ScopedLock lock(sIndexLock);
+		std::vector<Backup> backups;
+		if (loadIndex(backups)) {
+			backups.push_back({ backupFile, BackupEngine::backupSize(backupFile), backupFile.getLastModificationTime() });
+			saveIndex(backups);
+		}
+		// Without a valid index the next apply scans the directory anyway
+	}
+
+	std::vector<bool> BackupRetention::selectKept(std::vector<Backup> const& newestFirst, RetentionPolicy const& policy)
+	{
+		std::vector<bool> kept(newestFirst.size(), false);
+		for (size_t i = 0; i < newestFirst.size() && (int)i < policy.minimumKept; i++) {
+			kept[i] = true;
+		}
+
+		// Buckets from the local date and time of each backup. The current UTC offset would put the backups from the other side of a DST change into the wrong bucket
+		auto day = [](Time t) {
+			// Days since 1970-01-01 of the local calendar date
+			int64 y = t.getYear();
+			int64 m = t.getMonth() + 1;
+			if (m <= 2) y--;
+			int64 era = (y >= 0 ? y : y - 399) / 400;
+			int64 yearOfEra = y - era * 400;
+			int64 dayOfYear = (153 * (m > 2 ? m - 3 : m + 9) + 2) / 5 + t.getDayOfMonth() - 1;
+			int64 dayOfEra = yearOfEra * 365 + yearOfEra / 4 - yearOfEra / 100 + dayOfYear;
+			return era * 146097 + dayOfEra - 719468;
+		};
+		auto hour = [&day](Time t) { return day(t) * 24 + t.getHours(); };
+		auto week = [&day](Time t) { return (day(t) + 3) / 7; }; // Day 0 was a Thursday
+		auto month = [](Time t) { return (int64)t.getYear() * 12 + t.getMonth(); };
+		auto keepTier = [&](int slots, std::function<int64(Time)> bucketOf) {
+			int used = 0;
+			bool first = true;
+			int64 lastBucket = 0;
+			for (size_t i = 0; i < newestFirst.size() && used < slots; i++) {
+				int64 bucket = bucketOf(newestFirst[i].created);
+				if (first || bucket != lastBucket) {
+					kept[i] = true;
+					used++;
+					lastBucket = bucket;
+					first = false;
+				}
+			}
+		};
+		keepTier(policy.hourly, hour);
+		keepTier(policy.daily, day);
+		keepTier(policy.weekly, week);
+		keepTier(policy.monthly, month);
+
+		// Drop the oldest kept ones until the budget is met
+		int64 keptSize = 0;
+		for (size_t i = 0; i < newestFirst.size(); i++) {
+			if (kept[i]) keptSize += newestFirst[i].size;
+		}
+		for (size_t i = newestFirst.size(); i > 0 && keptSize > policy.budgetBytes; i--) {
+			if (kept[i - 1] && (int)(i - 1) >= policy.minimumKept) {
+				kept[i - 1] = false;
+				keptSize -= newestFirst[i - 1].size;
+			}
+		}
+		return kept;
+	}
+
+	void BackupRetention::apply(RetentionPolicy const& policy, int64& outSizeBefore, int64& outSizeAfter, int& outKept)
+	{
+		ScopedLock lock(sIndexLock);
+		std::vector<Backup> backups;
+		if (!loadIndex(backups)) {
+			backups = scan();
+			indexFile().deleteFile(); // So saveIndex stamps a new scan time
+		}
+		// Files deleted behind the back of the index would otherwise take the slots of existing backups until the next scan
+		backups.erase(std::remove_if(backups.begin(), backups.end(), [](Backup const& backup) { return !backup.file.existsAsFile(); }), backups.end());
+		std::sort(backups.begin(), backups.end(), [](Backup const& a, Backup const& b) { return a.created > b.created; });
+
+		auto kept = selectKept(backups, policy);
+		std::vector<Backup> remaining;
+		outSizeBefore = 0;
+		outSizeAfter = 0;
+		for (size_t i = 0; i < backups.size(); i++) {
+			outSizeBefore += backups[i].size;
+			if (kept[i]) {
+				remaining.push_back(backups[i]);
+				outSizeAfter += backups[i].size;
+			}
+			else if (!backups[i].file.deleteFile()) {
+				// Also true if it was deleted already behind the back of the index
+				SimpleLogger::instance()->postMessage("Error - failed to remove extra backup file, please check file permissions: " + backups[i].file.getFullPathName());
+				remaining.push_back(backups[i]);
+				outSizeAfter += backups[i].size;
+			}
+		}
+		outKept = (int)remaining.size();
+		saveIndex(remaining);
+	}
+
+}
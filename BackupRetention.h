@@ -0,0 +1,58 @@
+/*
+   Copyright (c) 2021 Christof Ruch. All rights reserved.
+
+   Dual licensed: Distributed under Affero GPL license by default, an MIT license is available for purchase
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+
+#include <vector>
+
+namespace midikraft {
+
+	// Which backups to keep. Each tier keeps the newest backup of each of its last n hours, days, weeks or months that have a backup at all,
+	// so a burst of backups within an hour costs only one slot and a long break doesn't delete the older ones.
+	// A backup is kept if any tier keeps it, and then the oldest are dropped until the kept ones fit into the byte budget
+	struct RetentionPolicy {
+		int hourly = 24;
+		int daily = 7;
+		int weekly = 4; // Weeks start on Monday
+		int monthly = 12;
+		int64 budgetBytes = 500000000;
+		int minimumKept = 3; // The newest ones, kept even if they exceed the budget
+	};
+
+	// Applies a RetentionPolicy to the backups of one database and suffix. The size and date of each backup are cached in a sidecar index
+	// next to the database, so the backup directory is only listed again when the index is missing or older than a week.
+	// Backups made by this program are added to the index as they are created.
+	class BackupRetention {
+	public:
+		struct Backup {
+			File file;
+			int64 size; // For a deduplicated backup, the size of the database it restores
+			Time created;
+		};
+
+		BackupRetention(File databaseFile, String suffix);
+
+		void recordBackup(File backupFile);
+
+		// Deletes all backups the policy doesn't keep, returns the sizes before and after
+		void apply(RetentionPolicy const& policy, int64& outSizeBefore, int64& outSizeAfter, int& outKept);
+
+		// Decides which of the backups, sorted newest first, to keep
+		static std::vector<bool> selectKept(std::vector<Backup> const& newestFirst, RetentionPolicy const& policy);
+
+	private:
+		File indexFile() const;
+		std::vector<Backup> scan() const;
+		bool loadIndex(std::vector<Backup>& outBackups) const;
+		void saveIndex(std::vector<Backup> const& backups) const;
+
+		File databaseFile_;
+		String suffix_;
+	};
+
+}
@@ -8,48 +8,76 @@
 
 #include "AutomaticCategory.h"
 
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
 namespace midikraft {
 
 	//std::vector<std::string> kLegacyBitIndexNames = { "Lead", "Pad", "Brass", "Organ", "Keys", "Bass", "Arp", "Pluck", "Drone", "Drum", "Bell", "SFX", "Ambient", "Wind",  "Voice" };
 
-	CategoryBitfield::CategoryBitfield(std::vector<std::shared_ptr<CategoryDefinition>> const &bitNames) : bitNames_(bitNames)
+	// Only the lower 63 bits are used, as the bitfield is stored in a signed 64 bit integer in the database
+	const uint64 kUsableBits = 0x7fffffffffffffffULL;
+
+	static int lowestSetBit(uint64 bits) {
+		jassert(bits != 0);
+#ifdef _MSC_VER
+		unsigned long index;
+		_BitScanForward64(&index, bits);
+		return (int)index;
+#else
+		return __builtin_ctzll(bits);
+#endif
+	}
+
+	CategoryBitfield::CategoryBitfield(std::vector<std::shared_ptr<CategoryDefinition>> const &bitNames) : bitNames_(bitNames), knownBits_(0)
 	{
+		for (auto const &bit : bitNames_) {
+			if (bit->id >= 0 && bit->id < kBitfieldSize) {
+				definitionForBit_[bit->id] = bit;
+				knownBits_ |= 1ULL << bit->id;
+				bitForName_.emplace(bit->name, bit->id); // First one wins, as the linear search did before
+			}
+			else if (bit->id >= kBitfieldSize) {
+				extendedDefinitions_.emplace(bit->id, bit);
+				bitForName_.emplace(bit->name, bit->id);
+			}
+			else {
+				jassertfalse;
+			}
+		}
 	}
 
 	void midikraft::CategoryBitfield::makeSetOfCategoriesFromBitfield(std::set<Category> &cats, int64 bitfield) const
 	{
 		cats.clear();
-		for (int i = 0; i < 63; i++) {
-			if (bitfield & (1LL << i)) {
-				// This bit is set, find the category that has this bitindex
-				bool found = false;
-				for (auto bit : bitNames_) {
-					if (i == bit->id) {
-						found = true;
-						cats.insert(Category(bit));
-					}
-				}
-				if (!found) {
-					jassertfalse;
-				}
-			}
+		uint64 bits = ((uint64)bitfield) & kUsableBits;
+		if ((bits & ~knownBits_) != 0) {
+			// At least one bit is set for which we have no category
+			jassertfalse;
+			bits &= knownBits_;
+		}
+		// Only visit the bits that are actually set
+		while (bits != 0) {
+			int i = lowestSetBit(bits);
+			cats.insert(Category(definitionForBit_[i]));
+			bits &= bits - 1;
 		}
 	}
 
 	juce::int64 CategoryBitfield::categorySetAsBitfield(std::set<Category> const &categories) const
 	{
 		uint64 mask = 0;
-		for (auto cat : categories) {
+		for (auto const &cat : categories) {
 			int bitindex = bitIndexForCategory(cat);
-			if (bitindex != -1) {
-				mask |= 1LL << bitindex;
-				jassert(bitindex >= 0 && bitindex < 63);
+			if (bitindex >= 0 && bitindex < kBitfieldSize) {
+				mask |= 1ULL << bitindex;
 			}
-			else {
+			else if (bitindex == -1) {
 				jassertfalse;
 			}
 		}
-		return mask;
+		return (juce::int64) mask;
 	}
 
 	int CategoryBitfield::maxBitIndex() const
@@ -61,15 +89,34 @@ namespace midikraft {
 		return 0;
 	}
 
-	int CategoryBitfield::bitIndexForCategory(Category &category) const {
-		for (int i = 0; i < bitNames_.size(); i++) {
-			if (category.category() == bitNames_[i]->name) {
-				return bitNames_[i]->id;
-			}
+	int CategoryBitfield::bitIndexForCategory(Category const &category) const {
+		// The id of a definition is its bit index, and it doesn't change when the category is renamed
+		auto def = category.def();
+		if (def && definitionForBitIndex(def->id)) {
+			return def->id;
+		}
+		// Categories not made from our definitions are resolved by name
+		auto found = bitForName_.find(category.category());
+		if (found != bitForName_.end()) {
+			return found->second;
 		}
 		return -1;
 	}
 
+	std::shared_ptr<CategoryDefinition> CategoryBitfield::definitionForBitIndex(int bitIndex) const
+	{
+		if (bitIndex >= 0 && bitIndex < kBitfieldSize) {
+			return definitionForBit_[bitIndex];
+		}
+		auto found = extendedDefinitions_.find(bitIndex);
+		return found != extendedDefinitions_.end() ? found->second : nullptr;
+	}
+
+	bool CategoryBitfield::hasExtendedCategories() const
+	{
+		return !extendedDefinitions_.empty();
+	}
+
 
 
 }
@@ -8,21 +8,33 @@
 
 #include "Category.h"
 
+#include <array>
+#include <unordered_map>
+
 namespace midikraft {
 
 	class CategoryBitfield {
 	public:
 		CategoryBitfield(std::vector<std::shared_ptr<CategoryDefinition>> const &bitNames);
 
+		// Only the categories with a bit index below kBitfieldSize are stored in the bitfield. The others exist only in the patch_category table of the database
+		static const int kBitfieldSize = 63;
+
 		void makeSetOfCategoriesFromBitfield(std::set<Category> &cats, int64 bitfield) const;
 		juce::int64 categorySetAsBitfield(std::set<Category> const &categories) const;
 
 		int maxBitIndex() const;
+		int bitIndexForCategory(Category const &category) const; // -1 if unknown
+		std::shared_ptr<CategoryDefinition> definitionForBitIndex(int bitIndex) const; // nullptr if unknown
+		bool hasExtendedCategories() const; // True if at least one category does not fit into the bitfield
 
 	private:
-		int bitIndexForCategory(Category &category) const;
-
 		std::vector<std::shared_ptr<CategoryDefinition>> bitNames_;
+		// Lookup tables built once in the constructor, so decoding and encoding need neither loops over all bits nor string compares 
+		std::array<std::shared_ptr<CategoryDefinition>, 64> definitionForBit_;
+		std::unordered_map<int, std::shared_ptr<CategoryDefinition>> extendedDefinitions_;
+		std::unordered_map<std::string, int> bitForName_;
+		uint64 knownBits_;
 	};
 
 }
@@ -0,0 +1,191 @@
+/*
+   Copyright (c) 2021 Christof Ruch. All rights reserved.
+
+   Dual licensed: Distributed under Affero GPL license by default, an MIT license is available for purchase
+*/
+
+#include "DatabaseInstrumentation.h"
+
+#include "Logger.h"
+
+#include "fmt/format.h"
+
+#include "SQLiteCpp/Database.h"
+#include "SQLiteCpp/Statement.h"
+#include "SQLiteCpp/../../sqlite3/sqlite3.h"
+
+namespace midikraft {
+
+	// The scope of the PatchDatabase call running on this thread
+	static thread_local DatabaseInstrumentation::Scope *sCurrentScope = nullptr;
+
+	var statsAsJson(DatabaseStats const &stats)
+	{
+		Array<var> operations;
+		for (auto const &operation : stats.operations) {
+			DynamicObject::Ptr entry = new DynamicObject();
+			entry->setProperty("operation", String(operation.operation));
+			entry->setProperty("calls", (int64)operation.calls);
+			entry->setProperty("totalMs", operation.totalMilliseconds);
+			entry->setProperty("maxMs", operation.maxMilliseconds);
+			Array<var> histogram;
+			for (auto count : operation.latencyHistogram) {
+				histogram.add((int64)count);
+			}
+			entry->setProperty("latencyHistogram", histogram);
+			entry->setProperty("rowsReturned", (int64)operation.rowsReturned);
+			entry->setProperty("rowsRead", (int64)operation.rowsRead);
+			entry->setProperty("fullScanSteps", (int64)operation.fullScanSteps);
+			entry->setProperty("sorts", (int64)operation.sorts);
+			entry->setProperty("virtualMachineSteps", (int64)operation.virtualMachineSteps);
+			entry->setProperty("blobBytesRead", (int64)operation.blobBytesRead);
+			operations.add(var(entry.get()));
+		}
+		Array<var> slowQueries;
+		for (auto const &slow : stats.slowQueries) {
+			DynamicObject::Ptr entry = new DynamicObject();
+			entry->setProperty("when", slow.when.toISO8601(true));
+			entry->setProperty("operation", String(slow.operation));
+			entry->setProperty("ms", slow.milliseconds);
+			entry->setProperty("sql", String(slow.sql));
+			entry->setProperty("parameters", String(slow.parameters));
+			entry->setProperty("queryPlan", String(slow.queryPlan));
+			slowQueries.add(var(entry.get()));
+		}
+		Array<var> bucketLimits;
+		for (auto limit : kLatencyBucketLimits) {
+			bucketLimits.add(limit);
+		}
+
+		DynamicObject::Ptr root = new DynamicObject();
+		root->setProperty("since", stats.since.toISO8601(true));
+		root->setProperty("slowQueryMs", stats.slowQueryMilliseconds);
+		root->setProperty("latencyBucketLimitsMs", bucketLimits);
+		root->setProperty("operations", operations);
+		root->setProperty("slowQueries", slowQueries);
+		return var(root.get());
+	}
+
+	DatabaseInstrumentation::Scope::Scope(DatabaseInstrumentation &owner, const char *operation) :
+		owner_(owner), startTime_(Time::getMillisecondCounterHiRes()), outer_(sCurrentScope)
+	{
+		counters_.operation = operation;
+		sCurrentScope = this;
+	}
+
+	DatabaseInstrumentation::Scope::~Scope()
+	{
+		sCurrentScope = outer_;
+		owner_.finish(*this, Time::getMillisecondCounterHiRes() - startTime_);
+	}
+
+	DatabaseInstrumentation::DatabaseInstrumentation() : slowQueryMilliseconds_(kDefaultSlowQueryMilliseconds), since_(Time::getCurrentTime())
+	{
+	}
+
+	void DatabaseInstrumentation::statementDone(SQLite::Statement &statement, uint64 rowsRead)
+	{
+		auto handle = statement.getPreparedStatement();
+		// Always reset the counters, so a statement coming back from the cache starts from zero even if it ran outside of a scope
+		int fullScanSteps = sqlite3_stmt_status(handle, SQLITE_STMTSTATUS_FULLSCAN_STEP, 1);
+		int sorts = sqlite3_stmt_status(handle, SQLITE_STMTSTATUS_SORT, 1);
+		int vmSteps = sqlite3_stmt_status(handle, SQLITE_STMTSTATUS_VM_STEP, 1);
+		if (sCurrentScope) {
+			auto &counters = sCurrentScope->counters_;
+			counters.rowsRead += rowsRead;
+			counters.fullScanSteps += (uint64)fullScanSteps;
+			counters.sorts += (uint64)sorts;
+			counters.virtualMachineSteps += (uint64)vmSteps;
+		}
+	}
+
+	void DatabaseInstrumentation::blobRead(size_t bytes)
+	{
+		if (sCurrentScope) {
+			sCurrentScope->counters_.blobBytesRead += bytes;
+		}
+	}
+
+	bool DatabaseInstrumentation::isSlow(double milliseconds) const
+	{
+		double threshold = slowQueryMilliseconds_.load();
+		return threshold >= 0.0 && milliseconds > threshold;
+	}
+
+	void DatabaseInstrumentation::recordSlowQuery(SQLite::Database &db, std::string const &operation, std::string const &sql, std::string const &parameters, double milliseconds,
+		std::function<void(SQLite::Statement &)> bindParameters)
+	{
+		SlowQuery slow;
+		slow.when = Time::getCurrentTime();
+		slow.operation = operation;
+		slow.milliseconds = milliseconds;
+		slow.sql = sql;
+		slow.parameters = parameters;
+		try {
+			SQLite::Statement explain(db, "EXPLAIN QUERY PLAN " + sql);
+			bindParameters(explain);
+			while (explain.executeStep()) {
+				slow.queryPlan += explain.getColumn("detail").getString() + "\n";
+			}
+		}
+		catch (SQLite::Exception &ex) {
+			slow.queryPlan = fmt::format("EXPLAIN QUERY PLAN failed: {}", ex.what());
+		}
+		SimpleLogger::instance()->postMessage(fmt::format("Performance warning - {} took {:.0f} ms: {}", operation, milliseconds, sql));
+
+		ScopedLock lock(lock_);
+		slowQueries_.push_back(std::move(slow));
+		while (slowQueries_.size() > kSlowQueryLogSize) {
+			slowQueries_.pop_front();
+		}
+	}
+
+	void DatabaseInstrumentation::finish(Scope const &scope, double milliseconds)
+	{
+		size_t bucket = 0;
+		while (bucket < kLatencyBucketLimits.size() && milliseconds >= kLatencyBucketLimits[bucket]) {
+			bucket++;
+		}
+
+		ScopedLock lock(lock_);
+		auto &stats = operations_[scope.counters_.operation];
+		stats.operation = scope.counters_.operation;
+		stats.calls++;
+		stats.totalMilliseconds += milliseconds;
+		stats.maxMilliseconds = std::max(stats.maxMilliseconds, milliseconds);
+		stats.latencyHistogram[bucket]++;
+		stats.rowsReturned += scope.counters_.rowsReturned;
+		stats.rowsRead += scope.counters_.rowsRead;
+		stats.fullScanSteps += scope.counters_.fullScanSteps;
+		stats.sorts += scope.counters_.sorts;
+		stats.virtualMachineSteps += scope.counters_.virtualMachineSteps;
+		stats.blobBytesRead += scope.counters_.blobBytesRead;
+	}
+
+	DatabaseStats DatabaseInstrumentation::stats() const
+	{
+		DatabaseStats result;
+		result.slowQueryMilliseconds = slowQueryMilliseconds_.load();
+		ScopedLock lock(lock_);
+		result.since = since_;
+		for (auto const &operation : operations_) {
+			result.operations.push_back(operation.second);
+		}
+		result.slowQueries.assign(slowQueries_.begin(), slowQueries_.end());
+		return result;
+	}
+
+	void DatabaseInstrumentation::reset()
+	{
+		ScopedLock lock(lock_);
+		operations_.clear();
+		slowQueries_.clear();
+		since_ = Time::getCurrentTime();
+	}
+
+	void DatabaseInstrumentation::setSlowQueryThreshold(double milliseconds)
+	{
+		slowQueryMilliseconds_ = milliseconds;
+	}
+
+}
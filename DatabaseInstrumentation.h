@@ -0,0 +1,110 @@
+/*
+   Copyright (c) 2021 Christof Ruch. All rights reserved.
+
+   Dual licensed: Distributed under Affero GPL license by default, an MIT license is available for purchase
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+
+#include <array>
+#include <atomic>
+#include <deque>
+#include <map>
+
+// Not included, as this header is part of the PatchDatabase.h interface
+namespace SQLite {
+	class Database;
+	class Statement;
+}
+
+namespace midikraft {
+
+	// Upper limits of the latency buckets in milliseconds, the last bucket counts everything slower
+	const size_t kLatencyBuckets = 8;
+	const std::array<double, kLatencyBuckets - 1> kLatencyBucketLimits = { 1.0, 4.0, 16.0, 64.0, 256.0, 1024.0, 4096.0 };
+	const double kDefaultSlowQueryMilliseconds = 250.0;
+	const size_t kSlowQueryLogSize = 50;
+
+	struct OperationStats {
+		std::string operation; // Name of the PatchDatabase method
+		uint64 calls = 0;
+		double totalMilliseconds = 0.0;
+		double maxMilliseconds = 0.0;
+		std::array<uint64, kLatencyBuckets> latencyHistogram{};
+		uint64 rowsReturned = 0; // Patches, lists or rows handed to the caller
+		uint64 rowsRead = 0; // Result rows stepped through by the SQL statements
+		uint64 fullScanSteps = 0; // Rows visited by full table scans, SQLITE_STMTSTATUS_FULLSCAN_STEP. Far more than rowsRead means a missing index
+		uint64 sorts = 0; // Sorts that could not use an index, SQLITE_STMTSTATUS_SORT
+		uint64 virtualMachineSteps = 0; // SQLITE_STMTSTATUS_VM_STEP, a measure of the total work done by SQLite
+		uint64 blobBytesRead = 0; // Patch data read from the database
+	};
+
+	struct SlowQuery {
+		Time when;
+		std::string operation;
+		double milliseconds = 0.0;
+		std::string sql;
+		std::string parameters; // The filter bound, as given by filterCacheKey, and skip and limit
+		std::string queryPlan; // EXPLAIN QUERY PLAN, one line per step
+	};
+
+	struct DatabaseStats {
+		Time since; // Opening the database or the last reset
+		double slowQueryMilliseconds = kDefaultSlowQueryMilliseconds;
+		std::vector<OperationStats> operations; // Sorted by operation
+		std::vector<SlowQuery> slowQueries; // Oldest first, only the latest kSlowQueryLogSize are kept
+	};
+
+	// For pulling the stats out of a running installation, e.g. into a support file
+	var statsAsJson(DatabaseStats const &stats);
+
+	// Counts and times the calls of the PatchDatabase methods, and keeps a log of the SQL statements that were slower than a threshold
+	class DatabaseInstrumentation {
+	public:
+		// Measures one call, from construction to destruction. Statements run on the same thread while the scope is alive are added to it,
+		// the innermost one if scopes are nested
+		class Scope {
+		public:
+			Scope(DatabaseInstrumentation &owner, const char *operation);
+			Scope(Scope const &) = delete;
+			Scope &operator=(Scope const &) = delete;
+			~Scope();
+
+			void setRowsReturned(size_t rows) { counters_.rowsReturned = rows; }
+
+		private:
+			friend class DatabaseInstrumentation;
+			DatabaseInstrumentation &owner_;
+			double startTime_;
+			OperationStats counters_;
+			Scope *outer_;
+		};
+
+		DatabaseInstrumentation();
+
+		// Call when a statement is done. Adds its counters to the scope of this thread and resets them, as cached statements are reused
+		static void statementDone(SQLite::Statement &statement, uint64 rowsRead);
+		static void blobRead(size_t bytes);
+
+		bool isSlow(double milliseconds) const;
+		// Runs EXPLAIN QUERY PLAN for the statement, on the connection that ran it, and adds it to the log
+		void recordSlowQuery(SQLite::Database &db, std::string const &operation, std::string const &sql, std::string const &parameters, double milliseconds,
+			std::function<void(SQLite::Statement &)> bindParameters);
+
+		DatabaseStats stats() const;
+		void reset();
+		void setSlowQueryThreshold(double milliseconds); // Negative disables the slow query log
+
+	private:
+		void finish(Scope const &scope, double milliseconds);
+
+		std::atomic<double> slowQueryMilliseconds_;
+		Time since_;
+		std::map<std::string, OperationStats> operations_;
+		std::deque<SlowQuery> slowQueries_;
+		CriticalSection lock_;
+	};
+
+}
@@ -10,6 +10,74 @@
 
 #include "Logger.h"
 
+#include <future>
+
+// Limits of the service per call
+const size_t kDynamoBatchWriteSize = 25;
+const size_t kDynamoBatchGetSize = 100;
+// Retries of unprocessed batch items. The wait doubles from kDynamoBackoffStartMs up to kDynamoBackoffMaxMs, with jitter so concurrent writers don't retry in lockstep
+const int kDynamoBatchAttempts = 8;
+const int kDynamoBackoffStartMs = 50;
+const int kDynamoBackoffMaxMs = 5000;
+
+static void backoff(int attempt) {
+	int delay = std::min(kDynamoBackoffMaxMs, kDynamoBackoffStartMs << std::min(attempt, 16));
+	Thread::sleep(delay / 2 + Random::getSystemRandom().nextInt(delay / 2 + 1));
+}
+
+template<typename TRequest> static void setProjection(TRequest &request, std::vector<std::string> const &projectedAttributes) {
+	// Through placeholders, as many attribute names like "name" are reserved words
+	if (projectedAttributes.empty()) return;
+	std::string projection;
+	for (size_t i = 0; i < projectedAttributes.size(); i++) {
+		std::string placeholder = (boost::format("#p%d") % i).str();
+		request.AddExpressionAttributeNames(placeholder.c_str(), projectedAttributes[i].c_str());
+		projection += (i > 0 ? ", " : "") + placeholder;
+	}
+	request.SetProjectionExpression(projection.c_str());
+}
+
+template<typename TRequest, typename TLaunch> static bool fetchPagesConcurrently(std::vector<TRequest> &requests, TLaunch launch, std::function<void(TDynamoMap &&result)> const &resultHandler) {
+	// Keep one page request in flight per request, and collect them in turn. While one page is handled, the others are on their way
+	typedef decltype(launch(requests.front())) TFuture;
+	std::vector<TFuture> inFlight;
+	for (auto &request : requests) {
+		inFlight.push_back(launch(request));
+	}
+	std::vector<bool> done(requests.size(), false);
+	bool success = true;
+	size_t remaining = requests.size();
+	while (remaining > 0) {
+		for (size_t i = 0; i < requests.size(); i++) {
+			if (done[i]) continue;
+			auto outcome = inFlight[i].get();
+			if (!outcome.IsSuccess()) {
+				SimpleLogger::instance()->postMessage(toString(outcome.GetError().GetMessage()));
+				success = false;
+				done[i] = true;
+				remaining--;
+				continue;
+			}
+			auto page = outcome.GetResultWithOwnership();
+			auto lastKey = page.GetLastEvaluatedKey();
+			if (!lastKey.empty()) {
+				requests[i].SetExclusiveStartKey(lastKey);
+				inFlight[i] = launch(requests[i]);
+			}
+			else {
+				done[i] = true;
+				remaining--;
+			}
+			// The page is ours, so the items can be moved out instead of copied. The SDK only has a const getter
+			auto &items = const_cast<Aws::Vector<TDynamoMap> &>(page.GetItems());
+			for (auto &item : items) {
+				resultHandler(std::move(item));
+			}
+		}
+	}
+	return success;
+}
+
 std::string toString(Aws::String const &aws) {
 	return std::string(aws.c_str(), aws.size());
 }
@@ -86,28 +154,25 @@ void DynamoDict::addAttribute(std::string const &name, std::vector<uint8> const
 	emplace(name.c_str(), Aws::DynamoDB::Model::AttributeValue().SetB(buffer));
 }
 
-DynamoUpdateItem::DynamoUpdateItem(std::string const &table, std::set<const char *> const &keyNames) :
-	keyNames_(keyNames)
+DynamoUpdateItem::DynamoUpdateItem(std::string const &table, std::set<const char *> const &keyNames)
 {
+	// Compare the key names by value, not by pointer
+	for (auto key : keyNames) {
+		keyNames_.insert(key);
+	}
 	SetTableName(table.c_str());
 }
 
 void DynamoUpdateItem::addDict(DynamoDict &dict)
 {
 	// First copy the keys to be used
-	for (auto key : keyNames_) {
+	for (auto const &key : keyNames_) {
 		AddKey(key, dict[key]);
 	}
 
 	// Now setup all non-key attributes
-	for (auto item : dict) {
-		bool isKey = false;
-		for (auto key : keyNames_) {
-			if (key == item.first) {
-				isKey = true;
-			}
-		}
-		if (!isKey) {
+	for (auto const &item : dict) {
+		if (keyNames_.find(item.first) == keyNames_.end()) {
 			addUpdateAttribute(toString(item.first), item.second);
 		}
 	}
@@ -123,25 +188,97 @@ void DynamoUpdateItem::addUpdateAttribute(std::string const &name, std::string c
 
 void DynamoUpdateItem::addUpdateAttribute(std::string const &name, TDynamoValue const &value)
 {
-	std::string attributeName = (boost::format("#%s") % name).str();
+	std::string attributeName = "#" + name;
 	AddExpressionAttributeNames(attributeName.c_str(), name.c_str());
-	std::string attributeVariable = (boost::format(":%s") % name).str();
+	std::string attributeVariable = ":" + name;
 	AddExpressionAttributeValues(attributeVariable.c_str(), value);
-	std::string setClause = (boost::format("%s = %s") % attributeName % attributeVariable).str();
-	setClauses_.push_back(setClause);
+	setClauses_.push_back(attributeName + " = " + attributeVariable);
 }
 
 void DynamoUpdateItem::setUpdateExpression()
 {
-	std::string updateExpression = "SET ";
+	size_t length = 4;
+	for (auto const &clause : setClauses_) {
+		length += clause.size() + 2;
+	}
+	Aws::String updateExpression;
+	updateExpression.reserve(length);
+	updateExpression += "SET ";
 	for (size_t i = 0; i < setClauses_.size(); i++) {
-		updateExpression += setClauses_[i];
-		if (i != setClauses_.size() - 1) {
-			// There are more to come
+		if (i > 0) {
 			updateExpression += ", ";
 		}
+		updateExpression += setClauses_[i].c_str();
 	}
-	SetUpdateExpression(updateExpression.c_str());
+	SetUpdateExpression(std::move(updateExpression));
+}
+
+DynamoUpdateBuilder::DynamoUpdateBuilder(std::string const &table, std::set<std::string> const &keyNames)
+{
+	for (auto const &key : keyNames) {
+		keyNames_.insert(key.c_str());
+	}
+	request_.SetTableName(table.c_str());
+}
+
+DynamoUpdateBuilder::Placeholders const &DynamoUpdateBuilder::placeholdersFor(Aws::String const &attribute)
+{
+	auto found = placeholders_.find(attribute);
+	if (found != placeholders_.end()) {
+		return found->second;
+	}
+	// Numbered instead of derived from the attribute name, which might contain characters not allowed in a placeholder
+	std::string number = (boost::format("%d") % placeholders_.size()).str();
+	Placeholders placeholders{ ("#a" + number).c_str(), (":v" + number).c_str() };
+	return placeholders_.emplace(attribute, std::move(placeholders)).first->second;
+}
+
+Aws::DynamoDB::Model::UpdateItemRequest const &DynamoUpdateBuilder::build(TDynamoMap &&item)
+{
+	TDynamoMap key;
+	TDynamoMap values;
+	attributes_.clear();
+	for (auto &attribute : item) {
+		if (keyNames_.find(attribute.first) != keyNames_.end()) {
+			key.emplace(attribute.first, std::move(attribute.second));
+		}
+		else {
+			auto const &placeholders = placeholdersFor(attribute.first);
+			attributes_.emplace_back(&placeholders_.find(attribute.first)->first, &placeholders);
+			values.emplace(placeholders.value, std::move(attribute.second));
+		}
+	}
+	jassert(key.size() == keyNames_.size());
+	jassert(!attributes_.empty()); // An update expression without clauses is rejected by the service
+
+	// The item map is ordered by name, so the same attributes come in the same order. The expression and its names stay in the request
+	// until the attributes change, only the key and the values are replaced per item
+	if (attributes_ != previousAttributes_ || previousAttributes_.empty()) {
+		Aws::String expression;
+		Aws::Map<Aws::String, Aws::String> names;
+		size_t length = 4;
+		for (auto const &attribute : attributes_) {
+			length += attribute.second->name.size() + attribute.second->value.size() + 5;
+		}
+		expression.reserve(length);
+		expression += "SET ";
+		for (size_t i = 0; i < attributes_.size(); i++) {
+			if (i > 0) {
+				expression += ", ";
+			}
+			expression += attributes_[i].second->name;
+			expression += " = ";
+			expression += attributes_[i].second->value;
+			names.emplace(attributes_[i].second->name, *attributes_[i].first);
+		}
+		request_.SetUpdateExpression(std::move(expression));
+		request_.SetExpressionAttributeNames(std::move(names));
+		previousAttributes_.swap(attributes_);
+	}
+
+	request_.SetKey(std::move(key));
+	request_.SetExpressionAttributeValues(std::move(values));
+	return request_;
 }
 
 DynamoQuery::DynamoQuery(std::string const &table, std::string const &keyName, std::string const &keyValue)
@@ -157,6 +294,11 @@ DynamoQuery::DynamoQuery(std::string const &table, std::string const &keyName, s
 	// The query is ready to be fired now
 }
 
+void DynamoQuery::setProjection(std::vector<std::string> const &projectedAttributes)
+{
+	::setProjection(*this, projectedAttributes);
+}
+
 bool DynamoQuery::fetchResults(const Aws::DynamoDB::DynamoDBClient &dynamoClient, std::function<void(TDynamoMap &result)> resultHandler)
 {
 	// We might have to run this query multiple times in order to retrieve all results from the database
@@ -168,9 +310,10 @@ bool DynamoQuery::fetchResults(const Aws::DynamoDB::DynamoDBClient &dynamoClient
 			return false;
 		}
 
-		// Use the result
-		Aws::DynamoDB::Model::QueryResult patches = result.GetResult();
-		for (auto item : patches.GetItems()) {
+		// Use the result, without copying each item
+		Aws::DynamoDB::Model::QueryResult patches = result.GetResultWithOwnership();
+		auto &items = const_cast<Aws::Vector<TDynamoMap> &>(patches.GetItems());
+		for (auto &item : items) {
 			resultHandler(item);
 		}
 		more = !patches.GetLastEvaluatedKey().empty();
@@ -179,6 +322,139 @@ bool DynamoQuery::fetchResults(const Aws::DynamoDB::DynamoDBClient &dynamoClient
 	return true;
 }
 
+bool DynamoQuery::fetchResultsConcurrently(const Aws::DynamoDB::DynamoDBClient &dynamoClient, std::vector<DynamoQuery> &queries, std::function<void(TDynamoMap &&result)> resultHandler)
+{
+	if (queries.empty()) return true;
+	return fetchPagesConcurrently(queries, [&dynamoClient](DynamoQuery &query) { return dynamoClient.QueryCallable(query); }, resultHandler);
+}
+
+DynamoParallelScan::DynamoParallelScan(std::string const &table, int totalSegments, std::vector<std::string> const &projectedAttributes)
+{
+	for (int i = 0; i < totalSegments; i++) {
+		Aws::DynamoDB::Model::ScanRequest segment;
+		segment.SetTableName(table.c_str());
+		segment.SetSegment(i);
+		segment.SetTotalSegments(totalSegments);
+		setProjection(segment, projectedAttributes);
+		segments_.push_back(segment);
+	}
+}
+
+bool DynamoParallelScan::fetchResults(const Aws::DynamoDB::DynamoDBClient &dynamoClient, std::function<void(TDynamoMap &&result)> resultHandler)
+{
+	if (segments_.empty()) return true;
+	return fetchPagesConcurrently(segments_, [&dynamoClient](Aws::DynamoDB::Model::ScanRequest &segment) { return dynamoClient.ScanCallable(segment); }, resultHandler);
+}
+
+DynamoBatchWrite::DynamoBatchWrite(std::string const &table) : table_(table.c_str())
+{
+}
+
+void DynamoBatchWrite::addPut(TDynamoMap &&item)
+{
+	Aws::DynamoDB::Model::PutRequest put;
+	put.SetItem(std::move(item));
+	requests_.push_back(Aws::DynamoDB::Model::WriteRequest().WithPutRequest(std::move(put)));
+}
+
+void DynamoBatchWrite::addDelete(TDynamoMap &&key)
+{
+	Aws::DynamoDB::Model::DeleteRequest remove;
+	remove.SetKey(std::move(key));
+	requests_.push_back(Aws::DynamoDB::Model::WriteRequest().WithDeleteRequest(std::move(remove)));
+}
+
+bool DynamoBatchWrite::flush(const Aws::DynamoDB::DynamoDBClient &dynamoClient)
+{
+	bool success = true;
+	for (size_t start = 0; start < requests_.size(); start += kDynamoBatchWriteSize) {
+		size_t end = std::min(start + kDynamoBatchWriteSize, requests_.size());
+		Aws::Vector<Aws::DynamoDB::Model::WriteRequest> batch(std::make_move_iterator(requests_.begin() + start), std::make_move_iterator(requests_.begin() + end));
+		for (int attempt = 0; !batch.empty(); attempt++) {
+			if (attempt == kDynamoBatchAttempts) {
+				SimpleLogger::instance()->postMessage((boost::format("Giving up on %d items to be written to DynamoDB, the table seems to be throttled") % batch.size()).str());
+				success = false;
+				break;
+			}
+			if (attempt > 0) {
+				backoff(attempt - 1);
+			}
+			Aws::DynamoDB::Model::BatchWriteItemRequest request;
+			request.AddRequestItems(table_, std::move(batch));
+			auto outcome = dynamoClient.BatchWriteItem(request);
+			if (!outcome.IsSuccess()) {
+				SimpleLogger::instance()->postMessage(toString(outcome.GetError().GetMessage()));
+				if (!outcome.GetError().ShouldRetry()) {
+					success = false;
+					break;
+				}
+				// Send the same batch again
+				batch = request.GetRequestItems().at(table_);
+				continue;
+			}
+			auto unprocessed = outcome.GetResultWithOwnership().GetUnprocessedItems();
+			auto found = unprocessed.find(table_);
+			batch = found != unprocessed.end() ? std::move(found->second) : Aws::Vector<Aws::DynamoDB::Model::WriteRequest>();
+		}
+	}
+	requests_.clear();
+	return success;
+}
+
+DynamoBatchGet::DynamoBatchGet(std::string const &table, std::vector<std::string> const &projectedAttributes) : table_(table.c_str()), projectedAttributes_(projectedAttributes)
+{
+}
+
+void DynamoBatchGet::addKey(TDynamoMap &&key)
+{
+	keys_.push_back(std::move(key));
+}
+
+bool DynamoBatchGet::fetchResults(const Aws::DynamoDB::DynamoDBClient &dynamoClient, std::function<void(TDynamoMap &&result)> resultHandler)
+{
+	bool success = true;
+	for (size_t start = 0; start < keys_.size(); start += kDynamoBatchGetSize) {
+		size_t end = std::min(start + kDynamoBatchGetSize, keys_.size());
+		Aws::DynamoDB::Model::KeysAndAttributes batch;
+		batch.SetKeys(Aws::Vector<TDynamoMap>(keys_.begin() + start, keys_.begin() + end));
+		setProjection(batch, projectedAttributes_);
+		for (int attempt = 0; !batch.GetKeys().empty(); attempt++) {
+			if (attempt == kDynamoBatchAttempts) {
+				SimpleLogger::instance()->postMessage((boost::format("Giving up on %d keys to be read from DynamoDB, the table seems to be throttled") % batch.GetKeys().size()).str());
+				success = false;
+				break;
+			}
+			if (attempt > 0) {
+				backoff(attempt - 1);
+			}
+			Aws::DynamoDB::Model::BatchGetItemRequest request;
+			request.AddRequestItems(table_, batch);
+			auto outcome = dynamoClient.BatchGetItem(request);
+			if (!outcome.IsSuccess()) {
+				SimpleLogger::instance()->postMessage(toString(outcome.GetError().GetMessage()));
+				if (!outcome.GetError().ShouldRetry()) {
+					success = false;
+					break;
+				}
+				continue;
+			}
+			auto result = outcome.GetResultWithOwnership();
+			auto &responses = const_cast<Aws::Map<Aws::String, Aws::Vector<TDynamoMap>> &>(result.GetResponses());
+			auto items = responses.find(table_);
+			if (items != responses.end()) {
+				for (auto &item : items->second) {
+					resultHandler(std::move(item));
+				}
+			}
+			auto unprocessed = result.GetUnprocessedKeys();
+			auto found = unprocessed.find(table_);
+			batch.SetKeys(found != unprocessed.end() ? found->second.GetKeys() : Aws::Vector<TDynamoMap>());
+		}
+	}
+	keys_.clear();
+	return success;
+}
+
 DynamoDeleteItem::DynamoDeleteItem(std::string const &table, DynamoDict &keys)
 {
 	SetTableName(table.c_str());
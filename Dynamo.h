@@ -15,6 +15,9 @@
 #include <aws/dynamodb/model/UpdateItemRequest.h>
 #include <aws/dynamodb/model/DeleteItemRequest.h>
 #include <aws/dynamodb/model/QueryRequest.h>
+#include <aws/dynamodb/model/ScanRequest.h>
+#include <aws/dynamodb/model/BatchWriteItemRequest.h>
+#include <aws/dynamodb/model/BatchGetItemRequest.h>
 
 typedef Aws::DynamoDB::Model::AttributeValue TDynamoValue;
 typedef Aws::Map<Aws::String, TDynamoValue> TDynamoMap;
@@ -38,15 +41,91 @@ public:
 	void setUpdateExpression();
 
 private:
-	std::set<const char *> keyNames_;
+	std::set<Aws::String> keyNames_;
 	std::vector<std::string> setClauses_;
 };
 
+// Builds the UpdateItem requests of a bulk upload, where all items go to the same table and mostly have the same attributes.
+// The placeholders of an attribute are created the first time it is seen, and the update expression and attribute names are
+// only rebuilt when the attributes differ from those of the previous item. The values are moved, not copied into the request
+class DynamoUpdateBuilder {
+public:
+	DynamoUpdateBuilder(std::string const &table, std::set<std::string> const &keyNames);
+
+	// The request returned is reused by the next call, send it before building the next one
+	Aws::DynamoDB::Model::UpdateItemRequest const &build(TDynamoMap &&item);
+
+private:
+	struct Placeholders {
+		Aws::String name;
+		Aws::String value;
+	};
+	Placeholders const &placeholdersFor(Aws::String const &attribute);
+
+	std::set<Aws::String> keyNames_;
+	std::map<Aws::String, Placeholders> placeholders_;
+	std::vector<std::pair<Aws::String const *, Placeholders const *>> attributes_;
+	std::vector<std::pair<Aws::String const *, Placeholders const *>> previousAttributes_; // The ones the expression of the request was built for
+	Aws::DynamoDB::Model::UpdateItemRequest request_;
+};
+
 class DynamoQuery : public Aws::DynamoDB::Model::QueryRequest {
 public:
 	DynamoQuery(std::string const &table, std::string const &keyName, std::string const &keyValue);
 
+	// Only fetch these attributes of the items
+	void setProjection(std::vector<std::string> const &projectedAttributes);
+
 	bool fetchResults(const Aws::DynamoDB::DynamoDBClient &dynamoClient, std::function<void(TDynamoMap &result)> resultHandler);
+
+	// Runs the queries concurrently with the async API of the client, e.g. one per synth. The items are handed over by move and on the calling thread
+	static bool fetchResultsConcurrently(const Aws::DynamoDB::DynamoDBClient &dynamoClient, std::vector<DynamoQuery> &queries, std::function<void(TDynamoMap &&result)> resultHandler);
+};
+
+// Splits a scan of the whole table into segments that are read concurrently
+class DynamoParallelScan {
+public:
+	DynamoParallelScan(std::string const &table, int totalSegments, std::vector<std::string> const &projectedAttributes = {});
+
+	// The items are handed over by move and on the calling thread
+	bool fetchResults(const Aws::DynamoDB::DynamoDBClient &dynamoClient, std::function<void(TDynamoMap &&result)> resultHandler);
+
+private:
+	std::vector<Aws::DynamoDB::Model::ScanRequest> segments_;
+};
+
+// Collects puts and deletes and sends them with BatchWriteItem, 25 per call. Items the service leaves unprocessed (e.g. when throttled) 
+// are sent again with exponential backoff
+class DynamoBatchWrite {
+public:
+	DynamoBatchWrite(std::string const &table);
+
+	void addPut(TDynamoMap &&item);
+	void addDelete(TDynamoMap &&key);
+	size_t pending() const { return requests_.size(); }
+
+	// Sends everything added so far. Returns false if items were still unprocessed after all retries, those are dropped
+	bool flush(const Aws::DynamoDB::DynamoDBClient &dynamoClient);
+
+private:
+	Aws::String table_;
+	Aws::Vector<Aws::DynamoDB::Model::WriteRequest> requests_;
+};
+
+// Fetches items by key with BatchGetItem, 100 per call, retrying unprocessed keys with exponential backoff
+class DynamoBatchGet {
+public:
+	DynamoBatchGet(std::string const &table, std::vector<std::string> const &projectedAttributes = {});
+
+	void addKey(TDynamoMap &&key);
+
+	// Items come in no particular order, and without an entry for keys that don't exist
+	bool fetchResults(const Aws::DynamoDB::DynamoDBClient &dynamoClient, std::function<void(TDynamoMap &&result)> resultHandler);
+
+private:
+	Aws::String table_;
+	std::vector<std::string> projectedAttributes_;
+	Aws::Vector<TDynamoMap> keys_;
 };
 
 class DynamoDeleteItem : public Aws::DynamoDB::Model::DeleteItemRequest {
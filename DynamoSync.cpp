@@ -0,0 +1,138 @@
+/*
+   Copyright (c) 2021 Christof Ruch. All rights reserved.
+
+   Dual licensed: Distributed under Affero GPL license by default, an MIT license is available for purchase
+*/
+
+#include "DynamoSync.h"
+
+#include "Logger.h"
+
+#include <boost/format.hpp>
+
+namespace midikraft {
+
+	const char * const kSyncFingerprint = "syncFingerprint";
+	// Local patches loaded and uploaded at once
+	const int kSyncChunkSize = 1000;
+
+	static PatchFilter syncFilter(std::shared_ptr<Synth> synth)
+	{
+		// Hidden patches are still local patches. Leaving them out would never upload them, and deleteRemoved would delete their remote copies
+		auto filter = PatchDatabase::allForSynth(synth);
+		filter.showHidden = true;
+		return filter;
+	}
+
+	DynamoPatchSync::DynamoPatchSync(Aws::DynamoDB::DynamoDBClient const &client, std::string const &table, std::string const &synthKey, std::string const &md5Key) :
+		client_(client), table_(table), synthKey_(synthKey), md5Key_(md5Key)
+	{
+	}
+
+	std::string DynamoPatchSync::fingerprint(TDynamoMap const &item, std::string const &fingerprintKey)
+	{
+		// The map is ordered by attribute name, so the serialization is canonical
+		MemoryBlock canonical;
+		for (auto const &attribute : item) {
+			if (toString(attribute.first) == fingerprintKey) continue;
+			auto value = attribute.second.SerializeAttribute();
+			canonical.append(attribute.first.c_str(), attribute.first.size());
+			canonical.append("=", 1);
+			canonical.append(value.c_str(), value.size());
+			canonical.append("\n", 1);
+		}
+		return MD5(canonical).toHexString().toStdString();
+	}
+
+	DynamoPatchSync::Result DynamoPatchSync::sync(PatchDatabase &db, std::vector<std::shared_ptr<Synth>> const &synths, TItemBuilder itemBuilder, bool deleteRemoved, ProgressHandler *progress)
+	{
+		Result result;
+
+		// Fetch keys and fingerprints of the remote table, all synths at once
+		std::vector<DynamoQuery> queries;
+		for (auto const &synth : synths) {
+			queries.emplace_back(table_, synthKey_, synth->getName());
+			queries.back().setProjection({ synthKey_, md5Key_, kSyncFingerprint });
+		}
+		std::map<std::string, std::map<std::string, std::string>> remote; // synth -> md5 -> fingerprint
+		if (!DynamoQuery::fetchResultsConcurrently(client_, queries, [this, &remote, &result](TDynamoMap &&item) {
+			std::string synthName, md5, fingerprint;
+			if (getStringIfSet(item, synthKey_.c_str(), synthName) && getStringIfSet(item, md5Key_.c_str(), md5)) {
+				getStringIfSet(item, kSyncFingerprint, fingerprint);
+				remote[synthName][md5] = fingerprint;
+				result.remotePatches++;
+			}
+		})) {
+			result.success = false;
+			return result;
+		}
+
+		int total = 0;
+		for (auto const &synth : synths) {
+			total += db.getPatchesCount(syncFilter(synth));
+		}
+
+		DynamoBatchWrite batch(table_);
+		for (auto const &synth : synths) {
+			auto &remoteOfSynth = remote[synth->getName()];
+			PatchPageToken page;
+			while (!page.endReached) {
+				if (progress && progress->shouldAbort()) {
+					result.success = false;
+					return result;
+				}
+				auto patches = db.getPatches(syncFilter(synth), page, kSyncChunkSize);
+				if (patches.empty() && !page.endReached) {
+					SimpleLogger::instance()->postMessage("Aborting sync - database error retrieving the local patches");
+					result.success = false;
+					return result;
+				}
+				for (auto const &patch : patches) {
+					result.localPatches++;
+					DynamoDict item = itemBuilder(patch);
+					std::string md5;
+					if (!getStringIfSet(item, md5Key_.c_str(), md5) || item.find(synthKey_.c_str()) == item.end()) {
+						jassertfalse;
+						SimpleLogger::instance()->postMessage("Program error - item builder did not set the key attributes, skipping patch " + patch.name());
+						continue;
+					}
+					std::string localFingerprint = fingerprint(item, kSyncFingerprint);
+					auto known = remoteOfSynth.find(md5);
+					bool upToDate = known != remoteOfSynth.end() && known->second == localFingerprint;
+					if (known != remoteOfSynth.end()) {
+						// What is left over in the end exists only remotely
+						remoteOfSynth.erase(known);
+					}
+					if (!upToDate) {
+						item.erase(kSyncFingerprint);
+						item.addAttribute(kSyncFingerprint, localFingerprint);
+						batch.addPut(std::move(item));
+						result.uploaded++;
+					}
+				}
+				if (!batch.flush(client_)) {
+					result.success = false;
+				}
+				if (progress && total > 0) progress->setProgressPercentage(std::min(1.0, result.localPatches / (double)total));
+			}
+		}
+
+		if (deleteRemoved) {
+			for (auto &synthEntry : remote) {
+				for (auto const &md5Entry : synthEntry.second) {
+					DynamoDict key;
+					key.addAttribute(synthKey_, synthEntry.first);
+					key.addAttribute(md5Key_, md5Entry.first);
+					batch.addDelete(std::move(key));
+					result.deleted++;
+				}
+			}
+			if (!batch.flush(client_)) {
+				result.success = false;
+			}
+		}
+		SimpleLogger::instance()->postMessage((boost::format("Synced %d local patches with %d in the cloud, uploaded %d and deleted %d") % result.localPatches % result.remotePatches % result.uploaded % result.deleted).str());
+		return result;
+	}
+
+}
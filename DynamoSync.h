@@ -0,0 +1,44 @@
+/*
+   Copyright (c) 2021 Christof Ruch. All rights reserved.
+
+   Dual licensed: Distributed under Affero GPL license by default, an MIT license is available for purchase
+*/
+
+#pragma once
+
+#include "Dynamo.h"
+#include "PatchDatabase.h"
+
+namespace midikraft {
+
+	// Brings a DynamoDB table with the synth name as hash key and the md5 as range key up to date with the local database, uploading only what differs.
+	// Every item uploaded carries a fingerprint of its attributes, so a diff needs only the keys and fingerprints of the remote table, never the patch data.
+	// A changed md5 means changed sysex, a changed fingerprint with the same md5 means changed metadata like the name or categories
+	class DynamoPatchSync {
+	public:
+		// Turns a patch into the item to store. It must contain the synth and md5 keys. Hidden patches are synced as well, so the item should carry the hidden flag
+		typedef std::function<DynamoDict(PatchHolder const &patch)> TItemBuilder;
+
+		struct Result {
+			bool success = true;
+			size_t localPatches = 0;
+			size_t remotePatches = 0;
+			size_t uploaded = 0;
+			size_t deleted = 0;
+		};
+
+		DynamoPatchSync(Aws::DynamoDB::DynamoDBClient const &client, std::string const &table, std::string const &synthKey = "synth", std::string const &md5Key = "md5");
+
+		// The remote state of all synths is queried concurrently. With deleteRemoved, remote patches that don't exist locally anymore are deleted from the table
+		Result sync(PatchDatabase &db, std::vector<std::shared_ptr<Synth>> const &synths, TItemBuilder itemBuilder, bool deleteRemoved, ProgressHandler *progress);
+
+		static std::string fingerprint(TDynamoMap const &item, std::string const &fingerprintKey);
+
+	private:
+		Aws::DynamoDB::DynamoDBClient const &client_;
+		std::string table_;
+		std::string synthKey_;
+		std::string md5Key_;
+	};
+
+}
@@ -0,0 +1,251 @@
+/*
+   Copyright (c) 2021 Christof Ruch. All rights reserved.
+
+   Dual licensed: Distributed under Affero GPL license by default, an MIT license is available for purchase
+*/
+
+#include "JsonBulkTransfer.h"
+
+#include "JsonSerialization.h"
+#include "JsonSchema.h"
+#include "ParallelJobs.h"
+#include "Logger.h"
+
+#include "fmt/format.h"
+
+#include <atomic>
+
+namespace midikraft {
+
+	// Patches per chunk. The importer keeps two chunks in memory, one being merged into the database while the next is decoded
+	const size_t kJsonChunkSize = 1000;
+
+	namespace {
+
+		// Finds the elements of a top level JSON array of objects without parsing them, so each can be parsed on its own and on any thread
+		class JsonArrayScanner {
+		public:
+			JsonArrayScanner(char const *data, size_t size) : data_(data), size_(size), pos_(0), failed_(false) {
+				skipWhitespace();
+				if (pos_ < size_ && data_[pos_] == '[') {
+					pos_++;
+				}
+				else {
+					failed_ = true;
+				}
+			}
+
+			// False at the end of the array or on a syntax error
+			bool next(char const *&outElement, size_t &outLength) {
+				if (failed_) return false;
+				skipWhitespace();
+				if (pos_ < size_ && data_[pos_] == ',') {
+					pos_++;
+					skipWhitespace();
+				}
+				if (pos_ >= size_ || data_[pos_] == ']') {
+					failed_ = pos_ >= size_;
+					return false;
+				}
+				if (data_[pos_] != '{') {
+					failed_ = true;
+					return false;
+				}
+				size_t start = pos_;
+				int depth = 0;
+				bool inString = false;
+				for (; pos_ < size_; pos_++) {
+					char c = data_[pos_];
+					if (inString) {
+						if (c == '\\') pos_++;
+						else if (c == '"') inString = false;
+					}
+					else if (c == '"') inString = true;
+					else if (c == '{' || c == '[') depth++;
+					else if (c == '}' || c == ']') {
+						if (--depth == 0) {
+							pos_++;
+							outElement = data_ + start;
+							outLength = pos_ - start;
+							return true;
+						}
+					}
+				}
+				failed_ = true;
+				return false;
+			}
+
+			bool failed() const { return failed_; }
+			size_t position() const { return pos_; }
+
+		private:
+			void skipWhitespace() {
+				while (pos_ < size_ && (data_[pos_] == ' ' || data_[pos_] == '\t' || data_[pos_] == '\r' || data_[pos_] == '\n')) pos_++;
+			}
+
+			char const *data_;
+			size_t size_;
+			size_t pos_;
+			bool failed_;
+		};
+
+		struct DecodedChunk {
+			std::vector<std::pair<char const *, size_t>> elements;
+			std::vector<PatchHolder> patches;
+			std::vector<uint8> valid; // Not vector<bool>, the slices write neighbouring entries at the same time
+		};
+
+	}
+
+	size_t JsonBulkTransfer::exportPatches(PatchDatabase &db, PatchFilter filter, File target, ProgressHandler *progress)
+	{
+		int total = db.getPatchesCount(filter);
+		ThreadPool &pool = db.workerPool();
+		TemporaryFile temp(target);
+		size_t written = 0;
+		{
+			FileOutputStream out(temp.getFile());
+			if (!out.openedOk()) {
+				SimpleLogger::instance()->postMessage("Error - could not open file for export: " + target.getFullPathName());
+				return 0;
+			}
+			JsonPatchStreamWriter writer(out);
+			// Keyset pagination, so the deep pages of a big export cost the same as the first one
+			PatchPageToken page;
+			while (!page.endReached) {
+				if (progress && progress->shouldAbort()) {
+					return 0;
+				}
+				auto patches = db.getPatches(filter, page, (int)kJsonChunkSize);
+				if (patches.empty() && !page.endReached) {
+					SimpleLogger::instance()->postMessage("Aborting export - database error retrieving the patches");
+					return 0;
+				}
+				std::vector<std::string> rendered(patches.size());
+				ParallelJobs render(pool);
+				bool renderedOk = render.runSlices(patches.size(), [&patches, &rendered](size_t begin, size_t end) {
+					std::string base64Scratch;
+					for (size_t i = begin; i < end; i++) {
+						JsonPatchStreamWriter::render(patches[i].synth().get(), patches[i], rendered[i], base64Scratch);
+					}
+				});
+				if (!renderedOk) {
+					SimpleLogger::instance()->postMessage("Aborting export - failed to render the patches: " + render.error());
+					return 0;
+				}
+				for (auto const &patchObject : rendered) {
+					if (!patchObject.empty()) {
+						writer.writeRendered(patchObject);
+					}
+				}
+				written = writer.numberWritten();
+				if (progress && total > 0) progress->setProgressPercentage(std::min(1.0, written / (double)total));
+			}
+			writer.finish();
+			out.flush();
+			if (out.getStatus().failed()) {
+				SimpleLogger::instance()->postMessage("Error - failed to write export file: " + out.getStatus().getErrorMessage());
+				return 0;
+			}
+		}
+		if (!temp.overwriteTargetFileWithTemporary()) {
+			SimpleLogger::instance()->postMessage("Error - could not replace export file " + target.getFullPathName());
+			return 0;
+		}
+		return written;
+	}
+
+	size_t JsonBulkTransfer::importPatches(PatchDatabase &db, File source, std::map<std::string, std::weak_ptr<Synth>> synths, std::shared_ptr<AutomaticCategory> categorizer,
+		ProgressHandler *progress, unsigned updateChoice)
+	{
+		MemoryMappedFile mapped(source, MemoryMappedFile::readOnly);
+		if (mapped.getData() == nullptr) {
+			SimpleLogger::instance()->postMessage("Error - could not open file for import: " + source.getFullPathName());
+			return 0;
+		}
+		JsonArrayScanner scanner(static_cast<char const *>(mapped.getData()), mapped.getSize());
+		ThreadPool &pool = db.workerPool();
+		std::atomic<size_t> skipped{ 0 };
+
+		auto decode = [&synths, categorizer, &skipped](DecodedChunk &chunk, size_t begin, size_t end) {
+			for (size_t i = begin; i < end; i++) {
+				rapidjson::Document doc;
+				doc.Parse(chunk.elements[i].first, chunk.elements[i].second);
+				if (doc.HasParseError() || !doc.IsObject() || !doc.HasMember(JsonSchema::kSynth) || !doc[JsonSchema::kSynth].IsString()) {
+					skipped++;
+					continue;
+				}
+				auto synth = synths.find(doc[JsonSchema::kSynth].GetString());
+				auto synthPtr = synth != synths.end() ? synth->second.lock() : nullptr;
+				// jsonToPatch also runs the auto categorizer, which is the expensive part besides creating the patch
+				if (!synthPtr || !JsonSerialization::jsonToPatch(synthPtr.get(), doc, chunk.patches[i], categorizer)) {
+					skipped++;
+					continue;
+				}
+				chunk.valid[i] = 1;
+			}
+		};
+		auto readChunk = [&scanner](DecodedChunk &chunk) {
+			chunk.elements.clear();
+			char const *element;
+			size_t length;
+			while (chunk.elements.size() < kJsonChunkSize && scanner.next(element, length)) {
+				chunk.elements.emplace_back(element, length);
+			}
+			chunk.patches.assign(chunk.elements.size(), PatchHolder());
+			chunk.valid.assign(chunk.elements.size(), 0);
+		};
+
+		// Decode the next chunk on the pool while the current one is merged into the database
+		DecodedChunk chunks[2];
+		int current = 0;
+		readChunk(chunks[current]);
+		auto decoding = std::make_unique<ParallelJobs>(pool);
+		decoding->addSlices(chunks[current].elements.size(), [&decode, &chunks, current](size_t begin, size_t end) {
+			decode(chunks[current], begin, end);
+		});
+		size_t inserted = 0;
+		size_t read = 0;
+		while (!chunks[current].elements.empty()) {
+			if (!decoding->wait()) {
+				SimpleLogger::instance()->postMessage(fmt::format("Aborting import - failed to decode the patches of {}: {}", source.getFullPathName().toStdString(), decoding->error()));
+				break;
+			}
+			int following = 1 - current;
+			readChunk(chunks[following]);
+			decoding = std::make_unique<ParallelJobs>(pool);
+			decoding->addSlices(chunks[following].elements.size(), [&decode, &chunks, following](size_t begin, size_t end) {
+				decode(chunks[following], begin, end);
+			});
+
+			std::vector<PatchHolder> patches;
+			for (size_t i = 0; i < chunks[current].patches.size(); i++) {
+				if (chunks[current].valid[i]) {
+					patches.push_back(chunks[current].patches[i]);
+				}
+			}
+			read += chunks[current].elements.size();
+			std::vector<PatchHolder> newPatches;
+			inserted += db.mergePatchesIntoDatabase(patches, newPatches, nullptr, updateChoice);
+			chunks[current].patches.clear();
+
+			if (progress) {
+				if (progress->shouldAbort()) {
+					break;
+				}
+				progress->setProgressPercentage(scanner.position() / (double)mapped.getSize());
+			}
+			current = following;
+		}
+		decoding.reset();
+
+		if (scanner.failed()) {
+			SimpleLogger::instance()->postMessage(fmt::format("Error - import file {} is not a JSON array of patches, stopped after {} entries", source.getFullPathName().toStdString(), read));
+		}
+		if (skipped > 0) {
+			SimpleLogger::instance()->postMessage(fmt::format("Skipped {} entries of the import file that could not be turned into patches of the given synths", skipped.load()));
+		}
+		return inserted;
+	}
+
+}
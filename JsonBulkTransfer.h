@@ -0,0 +1,28 @@
+/*
+   Copyright (c) 2021 Christof Ruch. All rights reserved.
+
+   Dual licensed: Distributed under Affero GPL license by default, an MIT license is available for purchase
+*/
+
+#pragma once
+
+#include "PatchDatabase.h"
+
+namespace midikraft {
+
+	// Moves whole collections of patches between a PatchDatabase and a JSON file, which is an array of patch objects as written by JsonPatchStreamWriter.
+	// Both directions work in chunks, so memory use doesn't grow with the number of patches, and do the per patch work
+	// (rendering, parsing, creating and categorizing the patches) on the worker pool of the database.
+	// As with the pipelined getPatches, Synth::patchFromPatchData and the AutomaticCategory are called from several threads at once and need to be thread safe
+	class JsonBulkTransfer {
+	public:
+		// Writes all patches matching the filter, in the order of the filter. The file is replaced only when the export completes. Returns the number of patches written
+		static size_t exportPatches(PatchDatabase &db, PatchFilter filter, File target, ProgressHandler *progress);
+
+		// Merges the patches of the file into the database, like an import from sysex files. Patches for synths not in the map are skipped.
+		// The file is memory mapped and parsed element by element. Returns the number of patches new to the database
+		static size_t importPatches(PatchDatabase &db, File source, std::map<std::string, std::weak_ptr<Synth>> synths, std::shared_ptr<AutomaticCategory> categorizer,
+			ProgressHandler *progress, unsigned updateChoice = PatchDatabase::UPDATE_ALL);
+	};
+
+}
@@ -24,8 +24,9 @@ namespace midikraft {
 	}
 
 	bool getBufferIfSet(rapidjson::Value &dbresult, const char *key, std::vector<uint8> &outBuffer) {
-		if (dbresult.HasMember(key)) {
-			outBuffer = JsonSerialization::stringToData(dbresult[key].GetString());
+		if (dbresult.HasMember(key) && dbresult[key].IsString()) {
+			// The length is stored in the value, no need to copy into a std::string first
+			JsonSerialization::stringToData(dbresult[key].GetString(), dbresult[key].GetStringLength(), outBuffer);
 			return true;
 		}
 		return false;
@@ -40,26 +41,33 @@ namespace midikraft {
 	}
 
 	std::string JsonSerialization::dataToString(std::vector<uint8> const &data) {
-		std::string binaryString;
-		for (auto byte : data) {
-			binaryString.push_back(byte);
-		}
-		// See https://stackoverflow.com/questions/7053538/how-do-i-encode-a-string-to-base64-using-only-boost
-		std::vector<char> buffer(2048);
-		size_t lengthWritten = boost::beast::detail::base64::encode(buffer.data(), data.data(), buffer.size());
-		jassert(lengthWritten < 2048);
-		std::string result(buffer.data(), lengthWritten);
+		std::string result;
+		dataToString(data, result);
 		return result;
 	}
 
-	std::vector<uint8> JsonSerialization::stringToData(std::string const string)
+	void JsonSerialization::dataToString(std::vector<uint8> const &data, std::string &outString) {
+		// Sized exactly up front, so there is one allocation at most - none if outString is reused and big enough already
+		outString.resize(boost::beast::detail::base64::encoded_size(data.size()));
+		size_t lengthWritten = boost::beast::detail::base64::encode(&outString[0], data.data(), data.size());
+		outString.resize(lengthWritten);
+	}
+
+	std::vector<uint8> JsonSerialization::stringToData(std::string const &string)
 	{
-		std::vector<uint8> outBuffer(2048, 0);
-		auto decoded_bytes = boost::beast::detail::base64::decode(outBuffer.data(), string.c_str(), 2048);
-		outBuffer.resize(decoded_bytes.first); // Trim output so it contains only the written part
+		std::vector<uint8> outBuffer;
+		stringToData(string.data(), string.size(), outBuffer);
 		return outBuffer;
 	}
 
+	void JsonSerialization::stringToData(char const *string, size_t length, std::vector<uint8> &outBuffer)
+	{
+		// An upper bound, the padding characters make the real result up to two bytes shorter. Not beast's decoded_size, which rounds down for input without padding
+		outBuffer.resize((length + 3) / 4 * 3);
+		auto decoded_bytes = boost::beast::detail::base64::decode(outBuffer.data(), string, length);
+		outBuffer.resize(decoded_bytes.first); // Trim output so it contains only the written part
+	}
+
 	std::string JsonSerialization::patchToJson(Synth *synth, PatchHolder *patchholder)
 	{
 		if (!patchholder || !patchholder->patch() || !synth) {
@@ -116,6 +124,98 @@ namespace midikraft {
 		}
 	}
 
+	JsonPatchStreamWriter::JsonPatchStreamWriter(OutputStream &out) : stream_(out), writer_(stream_)
+	{
+		writer_.StartArray();
+	}
+
+	JsonPatchStreamWriter::~JsonPatchStreamWriter()
+	{
+		finish();
+	}
+
+	template<typename Writer> void writeMember(Writer &writer, const char *key, std::string const &value)
+	{
+		writer.Key(key);
+		writer.String(value.data(), (rapidjson::SizeType)value.size());
+	}
+
+	template<typename Writer> void writePatchObject(Writer &writer, Synth *synth, PatchHolder const &patchholder, std::string &base64Scratch)
+	{
+		// The same fields as patchToJson
+		writer.StartObject();
+		writeMember(writer, JsonSchema::kSynth, synth->getName());
+		writeMember(writer, JsonSchema::kName, patchholder.patch()->patchName());
+		JsonSerialization::dataToString(patchholder.patch()->data(), base64Scratch);
+		writeMember(writer, JsonSchema::kSysex, base64Scratch);
+		auto realPatch = std::dynamic_pointer_cast<Patch>(patchholder.patch());
+		if (realPatch) {
+			writeMember(writer, JsonSchema::kPlace, std::to_string(realPatch->patchNumber()->midiProgramNumber().toZeroBased()));
+		}
+		writeMember(writer, JsonSchema::kMD5, patchholder.md5());
+		writer.EndObject();
+	}
+
+	bool JsonPatchStreamWriter::write(Synth *synth, PatchHolder const &patchholder)
+	{
+		if (finished_ || !patchholder.patch() || !synth) {
+			jassert(false);
+			return false;
+		}
+		writePatchObject(writer_, synth, patchholder, base64Scratch_);
+		written_++;
+		return true;
+	}
+
+	bool JsonPatchStreamWriter::writeRendered(std::string const &patchObject)
+	{
+		if (finished_ || patchObject.empty()) {
+			jassert(false);
+			return false;
+		}
+		writer_.RawValue(patchObject.data(), patchObject.size(), rapidjson::kObjectType);
+		written_++;
+		return true;
+	}
+
+	bool JsonPatchStreamWriter::render(Synth *synth, PatchHolder const &patchholder, std::string &outPatchObject, std::string &base64Scratch)
+	{
+		if (!patchholder.patch() || !synth) {
+			jassert(false);
+			return false;
+		}
+		rapidjson::StringBuffer buffer;
+		rapidjson::Writer<rapidjson::StringBuffer> writer(buffer);
+		writePatchObject(writer, synth, patchholder, base64Scratch);
+		outPatchObject.assign(buffer.GetString(), buffer.GetSize());
+		return true;
+	}
+
+	void JsonPatchStreamWriter::finish()
+	{
+		if (!finished_) {
+			writer_.EndArray();
+			stream_.Flush();
+			finished_ = true;
+		}
+	}
+
+	void JsonPatchStreamWriter::BufferedStream::Put(char c)
+	{
+		buffer_[used_++] = c;
+		if (used_ == buffer_.size()) {
+			Flush();
+		}
+	}
+
+	void JsonPatchStreamWriter::BufferedStream::Flush()
+	{
+		if (used_ > 0) {
+			out_.write(buffer_.data(), used_);
+			used_ = 0;
+		}
+	}
+
 	std::string JsonSerialization::patchInSessionID(Synth *synth, std::shared_ptr<SessionPatch> patch) {
 		// Every possible patch can be stored in the database once per synth and session.
 		// build a hash to represent this.
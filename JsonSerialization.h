@@ -11,6 +11,8 @@
 #include "AutomaticCategory.h"
 
 #include <rapidjson/document.h>
+#include <rapidjson/writer.h>
+#include <rapidjson/stringbuffer.h>
 
 namespace midikraft {
 
@@ -20,9 +22,46 @@ namespace midikraft {
 	public:
 		static std::string patchInSessionID(Synth *synth, std::shared_ptr<SessionPatch> patch);
 		static std::string dataToString(std::vector<uint8> const &data);
-		static std::vector<uint8> stringToData(std::string const string);
+		static void dataToString(std::vector<uint8> const &data, std::string &outString); // Reuses the capacity of outString
+		static std::vector<uint8> stringToData(std::string const &string);
+		static void stringToData(char const *string, size_t length, std::vector<uint8> &outBuffer); // Reuses the capacity of outBuffer
 		static std::string patchToJson(Synth *synth, PatchHolder *patchholder);
 		static bool jsonToPatch(Synth *activeSynth, rapidjson::Value &patch, PatchHolder &outPatchHolder, std::shared_ptr<AutomaticCategory> categorizer);
 	};
 
+	// Writes a JSON array of patches in the format of patchToJson straight to a stream, without building a document.
+	// So memory stays constant no matter how many patches are exported. The array is closed by finish() or the destructor
+	class JsonPatchStreamWriter {
+	public:
+		JsonPatchStreamWriter(OutputStream &out);
+		~JsonPatchStreamWriter();
+
+		bool write(Synth *synth, PatchHolder const &patchholder);
+		// For rendering on several threads - render() produces the JSON object of one patch independently, writeRendered() appends it
+		static bool render(Synth *synth, PatchHolder const &patchholder, std::string &outPatchObject, std::string &base64Scratch);
+		bool writeRendered(std::string const &patchObject);
+		void finish();
+		size_t numberWritten() const { return written_; }
+
+	private:
+		// The stream concept of rapidjson, writing to a JUCE stream in big blocks instead of byte by byte
+		class BufferedStream {
+		public:
+			typedef char Ch;
+			BufferedStream(OutputStream &out) : out_(out) {}
+			void Put(char c);
+			void Flush();
+		private:
+			OutputStream &out_;
+			std::vector<char> buffer_ = std::vector<char>(65536);
+			size_t used_ = 0;
+		};
+
+		BufferedStream stream_;
+		rapidjson::Writer<BufferedStream> writer_;
+		std::string base64Scratch_;
+		size_t written_ = 0;
+		bool finished_ = false;
+	};
+
 }
\ No newline at end of file
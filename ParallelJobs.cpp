@@ -0,0 +1,106 @@
+/*
+   Copyright (c) 2021 Christof Ruch. All rights reserved.
+
+   Dual licensed: Distributed under Affero GPL license by default, an MIT license is available for purchase
+*/
+
+#include "ParallelJobs.h"
+
+#include <atomic>
+
+namespace midikraft {
+
+	struct ParallelJobs::State {
+		std::atomic<int> pending{ 0 };
+		WaitableEvent jobDone;
+		CriticalSection errorLock;
+		std::string firstError;
+
+		void recordError(std::string const &error) {
+			ScopedLock lock(errorLock);
+			if (firstError.empty()) {
+				firstError = error.empty() ? "unknown error" : error;
+			}
+		}
+
+		void waitUntilBelow(int limit) {
+			while (pending.load() >= limit) {
+				jobDone.wait(50);
+			}
+		}
+	};
+
+	ParallelJobs::ParallelJobs(ThreadPool &pool, int maxInFlight) : pool_(pool), maxInFlight_(maxInFlight), state_(std::make_shared<State>())
+	{
+	}
+
+	ParallelJobs::~ParallelJobs()
+	{
+		state_->waitUntilBelow(1);
+	}
+
+	void ParallelJobs::addJob(std::function<void()> job)
+	{
+		if (maxInFlight_ > 0) {
+			state_->waitUntilBelow(maxInFlight_);
+		}
+		state_->pending++;
+		pool_.addJob([state = state_, job = std::move(job)]() {
+			// Count the job as done from a destructor, else a throwing job would let the caller wait forever
+			struct JobDone {
+				State &state;
+				~JobDone() {
+					state.pending--;
+					state.jobDone.signal();
+				}
+			} jobDone{ *state };
+			try {
+				job();
+			}
+			catch (std::exception &e) {
+				state->recordError(e.what());
+			}
+			catch (...) {
+				state->recordError("unknown exception");
+			}
+		});
+	}
+
+	void ParallelJobs::addSlices(size_t count, std::function<void(size_t begin, size_t end)> const &work)
+	{
+		size_t slices = std::min((size_t)std::max(1, pool_.getNumThreads()), count);
+		for (size_t s = 0; s < slices; s++) {
+			size_t begin = count * s / slices;
+			size_t end = count * (s + 1) / slices;
+			addJob([work, begin, end]() { work(begin, end); });
+		}
+	}
+
+	bool ParallelJobs::runSlices(size_t count, std::function<void(size_t begin, size_t end)> const &work)
+	{
+		size_t slices = std::min((size_t)std::max(1, pool_.getNumThreads()) + 1, count);
+		for (size_t s = 1; s < slices; s++) {
+			size_t begin = count * s / slices;
+			size_t end = count * (s + 1) / slices;
+			addJob([work, begin, end]() { work(begin, end); });
+		}
+		if (slices > 0) {
+			work(0, count / slices);
+		}
+		return wait();
+	}
+
+	bool ParallelJobs::wait()
+	{
+		state_->waitUntilBelow(1);
+		ScopedLock lock(state_->errorLock);
+		return state_->firstError.empty();
+	}
+
+	std::string ParallelJobs::error() const
+	{
+		ScopedLock lock(state_->errorLock);
+		return state_->firstError;
+	}
+
+}
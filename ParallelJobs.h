@@ -0,0 +1,42 @@
+/*
+   Copyright (c) 2021 Christof Ruch. All rights reserved.
+
+   Dual licensed: Distributed under Affero GPL license by default, an MIT license is available for purchase
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+
+#include <functional>
+#include <memory>
+#include <string>
+
+namespace midikraft {
+
+	// Fans work out to a thread pool and waits for it. The jobs share their state with this object, so a job never touches the stack of the caller.
+	// A job counts as done also when it throws, the first error is kept and reported by wait() on the calling thread.
+	// The destructor waits for all jobs as well, as they usually refer to data of the caller
+	class ParallelJobs {
+	public:
+		explicit ParallelJobs(ThreadPool &pool, int maxInFlight = 0); // With a limit, addJob blocks while that many jobs are not done
+		~ParallelJobs();
+
+		void addJob(std::function<void()> job);
+		// One job per thread of the pool, each for a slice of [0, count)
+		void addSlices(size_t count, std::function<void(size_t begin, size_t end)> const &work);
+		// Like addSlices, but the calling thread does the first slice itself and then waits. Returns the result of wait()
+		bool runSlices(size_t count, std::function<void(size_t begin, size_t end)> const &work);
+
+		// Waits for all jobs added so far. False if one of them threw, error() has its message
+		bool wait();
+		std::string error() const;
+
+	private:
+		struct State;
+		ThreadPool &pool_;
+		int maxInFlight_;
+		std::shared_ptr<State> state_;
+	};
+
+}
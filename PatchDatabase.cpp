@@ -19,8 +19,17 @@
 #include "ProgressHandler.h"
 
 #include "FileHelpers.h"
+#include "StatementCache.h"
+#include "BackupEngine.h"
+#include "BackupRetention.h"
+#include "DatabaseInstrumentation.h"
+#include "PatchSnapshot.h"
+#include "ParallelJobs.h"
 
 #include <iostream>
+#include <atomic>
+#include <algorithm>
+#include <optional>
 #include "fmt/format.h"
 
 #include "SQLiteCpp/Database.h"
@@ -34,7 +43,25 @@ namespace midikraft {
 	const std::string kDataBaseFileName = "SysexDatabaseOfAllPatches.db3";
 	const std::string kDataBaseBackupSuffix = "-backup";
 
-	const int SCHEMA_VERSION = 8;
+	// Number of patches written per transaction by the bulk operations
+	const size_t kBulkChunkSize = 1000;
+	// Number of md5s looked up with one IN clause, needs to stay below SQLite's limit for the number of bound variables (999 in old versions)
+	const size_t kLookupChunkSize = 500;
+	const size_t kStatementCacheSize = 128; // Per connection. Filter shapes and the IN lists of the bulk lookups are the main consumers
+	const size_t kQueryCacheSize = 64; // Entries, a page of patches counts as one entry
+	const size_t kQueryCachePatchBudget = 10000; // Patches held by all cached pages together, bigger pages are not cached at all
+	const double kSlowOpenMilliseconds = 250.0; // Opening slower than this logs the time of each phase
+	// Rows handed to a decode thread at once by the pipelined getPatches, and the number of batches the reader may run ahead of the decoders
+	const size_t kDecodeBatchSize = 256;
+	const int kDecodeBatchesInFlight = 8;
+	// Distance between the order_num of neighbouring list entries after putPatchList or a compaction. Each insert or move into a gap halves it,
+	// so 20 of them at the same spot are possible before the list needs to be renumbered
+	const int64 kListOrderGap = 1 << 20;
+
+	const std::string kInsertPatchSql = "INSERT INTO patches (synth, md5, name, type, data, favorite, hidden, sourceID, sourceName, sourceInfo, midiBankNo, midiProgramNo, categories, categoryUserDecision)"
+		" VALUES (:SYN, :MD5, :NAM, :TYP, :DAT, :FAV, :HID, :SID, :SNM, :SRC, :BNK, :PRG, :CAT, :CUD)";
+
+	const int SCHEMA_VERSION = 14;
 	/* History */
 	/* 1 - Initial schema */
 	/* 2 - adding hidden flag (aka deleted) */
@@ -44,22 +71,81 @@ namespace midikraft {
 	/* 6 - adding the table categories to track which bit index is used for which tag */
 	/* 7 - adding the table lists to allow storing lists of patches */
 	/* 8 - adding synth name, timestamp and banknumber to patch list to allow store synth banks */
+	/* 9 - adding indexes matching the filter, list and import queries */
+	/* 10 - extending the name index to the full sort key of Order_by_Name for keyset pagination */
+	/* 11 - adding the full text index patch_names for name search, if the SQLite build supports FTS5 with trigrams */
+	/* 12 - adding the trigger maintained name_counts table for the duplicate name filter */
+	/* 13 - adding the patch_category table, indexing the categories outside of the bitfield columns and allowing more than 63 categories */
+	/* 14 - spreading the order_num of list entries by kListOrderGap, so inserts and moves only need to update one row */
 
 	class PatchDatabase::PatchDataBaseImpl {
 	public:
-		PatchDataBaseImpl(std::string const& databaseFile, OpenMode mode)
-			: db_(databaseFile.c_str(), mode == OpenMode::READ_ONLY ? SQLite::OPEN_READONLY : (SQLite::OPEN_READWRITE | SQLite::OPEN_CREATE)), bitfield({}),
-			mode_(mode)
+		// Immutable snapshot of the categories table. A reload replaces the whole snapshot, so a loader can use one for a whole query
+		struct CategoryCache {
+			uint64 version = 0;
+			std::vector<Category> categories;
+			CategoryBitfield bitfield = CategoryBitfield({});
+		};
+
+
+		PatchDataBaseImpl(std::string const& databaseFile, OpenMode mode, DatabaseOpenOptions const& options, BackupEngine& backups, DatabaseInstrumentation& instrumentation)
+			: db_(databaseFile.c_str(), mode == OpenMode::READ_ONLY ? SQLite::OPEN_READONLY : (SQLite::OPEN_READWRITE | SQLite::OPEN_CREATE)),
+			mode_(mode), backups_(backups), instrumentation_(instrumentation), backupFormat_(options.backupFormat), categoryCache_(std::make_shared<CategoryCache>()), categoryReloads_(0)
 		{
-			createSchema();
-			manageBackupDiskspace(kDataBaseBackupSuffix);
-			categoryDefinitions_ = getCategories();
+			// Time every phase, slow starts are usually caused by one of them (e.g. a backup directory on a network drive)
+			double phaseStart = Time::getMillisecondCounterHiRes();
+			auto endPhase = [&phaseStart](double& phaseMilliseconds) {
+				double now = Time::getMillisecondCounterHiRes();
+				phaseMilliseconds = now - phaseStart;
+				phaseStart = now;
+			};
+			setupJournalMode(options);
+			endPhase(openTimings_.journalMode);
+			if (!options.fastOpen || !quickSchemaCheck()) {
+				createSchema();
+				checkNameSearchIndex();
+				checkCategoryIndex();
+				stampSchemaVersion();
+			}
+			endPhase(openTimings_.schema);
+			File dbFile(db_.getFilename());
+			if (options.fastOpen) {
+				// The retention only deletes old backup files, nothing the first query has to wait for
+				String suffix(kDataBaseBackupSuffix);
+				RetentionPolicy policy = options.backupRetention;
+				backups_.queueTask([dbFile, suffix, policy]() { manageBackupDiskspace(dbFile, suffix, policy); });
+			}
+			else {
+				manageBackupDiskspace(dbFile, kDataBaseBackupSuffix, options.backupRetention);
+			}
+			endPhase(openTimings_.retention);
+			reloadCategories();
+			endPhase(openTimings_.categories);
+			if (isWriteAheadLogActive()) {
+				openReadConnections(databaseFile, options.readConnections);
+			}
+			endPhase(openTimings_.readConnections);
+			if (options.columnarSnapshot) {
+				openSnapshot();
+			}
+			endPhase(openTimings_.snapshot);
+			openTimings_.fastOpen = options.fastOpen;
+			openTimings_.total = openTimings_.journalMode + openTimings_.schema + openTimings_.retention + openTimings_.categories + openTimings_.readConnections + openTimings_.snapshot;
+			if (openTimings_.total > kSlowOpenMilliseconds) {
+				SimpleLogger::instance()->postMessage(fmt::format("Opening the database took {:.0f} ms - journal mode {:.0f} ms, schema {:.0f} ms, backup retention {:.0f} ms, categories {:.0f} ms, read connections {:.0f} ms, snapshot {:.0f} ms{}",
+					openTimings_.total, openTimings_.journalMode, openTimings_.schema, openTimings_.retention, openTimings_.categories, openTimings_.readConnections, openTimings_.snapshot, options.fastOpen ? "" : ". Consider the fast open option"));
+			}
 		}
 
 		~PatchDataBaseImpl() {
-			// Only make the automatic database backup when we are not in read only mode, else there is nothing to backup
+			// Only make the automatic database backup when we are not in read only mode, else there is nothing to backup.
+			// Skip it as well if nothing was written since the last one, neither in this session nor in one that ended without its backup
 			if (mode_ == OpenMode::READ_WRITE) {
-				PatchDataBaseImpl::makeDatabaseBackup(kDataBaseBackupSuffix);
+				File dbFile(db_.getFilename());
+				if (sqlite3_total_changes(db_.getHandle()) > 0 || BackupEngine::hasChangesSinceLastBackup(dbFile, kDataBaseBackupSuffix)) {
+					// Made by the background thread of the engine, which outlives this
+					backups_.queueBackup(dbFile, kDataBaseBackupSuffix, backupFormat_);
+				}
 			}
 		}
 
@@ -68,6 +154,7 @@ namespace midikraft {
 			if (dbFile.existsAsFile()) {
 				File backupCopy(dbFile.getParentDirectory().getNonexistentChildFile(dbFile.getFileNameWithoutExtension() + suffix, dbFile.getFileExtension(), false));
 				db_.backup(backupCopy.getFullPathName().toStdString().c_str(), SQLite::Database::Save);
+				BackupRetention(dbFile, suffix).recordBackup(backupCopy);
 				return backupCopy.getFullPathName().toStdString();
 			}
 			else {
@@ -89,40 +176,105 @@ namespace midikraft {
 			db.backup(backupFile.getFullPathName().toStdString().c_str(), SQLite::Database::Save);
 		}
 
-		void backupIfNecessary(bool& done) {
-			if (!done && mode_ == PatchDatabase::OpenMode::READ_WRITE) {
-				makeDatabaseBackup("-before-migration");
-				done = true;
+		std::string journalMode() {
+			return db_.execAndGet("PRAGMA journal_mode").getString();
+		}
+
+		bool isWriteAheadLogActive() {
+			return String(journalMode()).equalsIgnoreCase("wal");
+		}
+
+		void setupJournalMode(DatabaseOpenOptions const& options) {
+			// The journal mode is persistent in the database file, so it is switched in both directions. A read only connection has to take what it finds
+			if (mode_ == OpenMode::READ_ONLY) {
+				return;
+			}
+			try {
+				if (options.writeAheadLog) {
+					if (!String(db_.execAndGet("PRAGMA journal_mode=WAL").getString()).equalsIgnoreCase("wal")) {
+						SimpleLogger::instance()->postMessage("Could not switch database to write ahead log mode, readers will wait for writers");
+					}
+					else {
+						// Recommended for WAL, a power loss can only lose the last transactions, but never corrupt the database
+						db_.exec("PRAGMA synchronous=NORMAL");
+					}
+				}
+				else if (isWriteAheadLogActive()) {
+					db_.execAndGet("PRAGMA journal_mode=DELETE");
+				}
+			}
+			catch (SQLite::Exception& ex) {
+				SimpleLogger::instance()->postMessage(fmt::format("DATABASE ERROR in setupJournalMode: SQL Exception {}", ex.what()));
 			}
 		}
 
-		//TODO a better strategy than the last 3 backups would be to group by week, month, to keep older ones
-		void manageBackupDiskspace(String suffix) {
-			// Build a list of all backups on disk and calculate the size of it. Do not keep more than 500 mio bytes or the last 3 copies if they together make up more than 500 mio bytes
-			File activeDBFile(db_.getFilename());
-			File backupDirectory(activeDBFile.getParentDirectory());
-			auto backupsFiles = backupDirectory.findChildFiles(File::TypesOfFileToFind::findFiles, false, activeDBFile.getFileNameWithoutExtension() + suffix + "*" + activeDBFile.getFileExtension());
-			size_t backupSize = 0;
-			size_t keptBackupSize = 0;
-			size_t numKept = 0;
-			// Sort by date ascending
-			auto sortComperator = FileDateComparatorNewestFirst(); // gcc wants this as an l-value
-			backupsFiles.sort(sortComperator, false);
-			for (auto file : backupsFiles) {
-				backupSize += file.getSize();
-				if (backupSize > 500000000 && numKept > 2) {
-					//SimpleLogger::instance()->postMessage("Removing database backup file to keep disk space used below 50 million bytes: " + file.getFullPathName());
-					if (!file.deleteFile()) {
-						SimpleLogger::instance()->postMessage("Error - failed to remove extra backup file, please check file permissions: " + file.getFullPathName());
+		void openReadConnections(std::string const& databaseFile, int count) {
+			// Read only connections for the asynchronous queries. In WAL mode they see the last committed state and don't wait for the writer connection db_
+			try {
+				for (int i = 0; i < count; i++) {
+					readConnections_.push_back(std::make_unique<SQLite::Database>(databaseFile.c_str(), SQLite::OPEN_READONLY));
+					readStatements_[readConnections_.back().get()] = std::make_unique<StatementCache>(*readConnections_.back(), kStatementCacheSize);
+					idleReadConnections_.push_back(readConnections_.back().get());
+				}
+			}
+			catch (SQLite::Exception& ex) {
+				SimpleLogger::instance()->postMessage(fmt::format("DATABASE ERROR opening read connections, continuing with {}: SQL Exception {}", readConnections_.size(), ex.what()));
+			}
+		}
+
+		StatementCache& statementsFor(SQLite::Database& db) {
+			// The read connections are only opened in the constructor, so the map can be read without locking
+			auto found = readStatements_.find(&db);
+			return found != readStatements_.end() ? *found->second : statements_;
+		}
+
+		bool withReadConnection(bool useReadConnection, std::function<bool(SQLite::Database&)> operation) {
+			// Runs the operation on an idle read connection of the pool, waiting for one if all are busy. Without a pool, everything runs on db_
+			if (!useReadConnection || readConnections_.empty()) {
+				return operation(db_);
+			}
+			struct Lease {
+				PatchDataBaseImpl& impl;
+				SQLite::Database* connection;
+				~Lease() {
+					{
+						ScopedLock lock(impl.readConnectionLock_);
+						impl.idleReadConnections_.push_back(connection);
 					}
+					impl.readConnectionReturned_.signal();
 				}
-				else {
-					numKept++;
-					keptBackupSize += file.getSize();
+			};
+			SQLite::Database* connection = nullptr;
+			while (connection == nullptr) {
+				{
+					ScopedLock lock(readConnectionLock_);
+					if (!idleReadConnections_.empty()) {
+						connection = idleReadConnections_.back();
+						idleReadConnections_.pop_back();
+					}
 				}
+				if (connection == nullptr) {
+					readConnectionReturned_.wait(100);
+				}
+			}
+			Lease lease{ *this, connection };
+			return operation(*connection);
+		}
+
+		void backupIfNecessary(bool& done) {
+			if (!done && mode_ == PatchDatabase::OpenMode::READ_WRITE) {
+				makeDatabaseBackup("-before-migration");
+				done = true;
 			}
-			if (backupSize != keptBackupSize) {
-				SimpleLogger::instance()->postMessage(fmt::format("Removing all but {} backup files reducing disk space used from {} to {} bytes", numKept, backupSize, keptBackupSize));
+		}
+
+		static void manageBackupDiskspace(File activeDBFile, String suffix, RetentionPolicy const& policy) {
+			// Thin out the backups by age into hourly, daily, weekly and monthly ones, within the byte budget
+			int64 sizeBefore, sizeAfter;
+			int numKept;
+			BackupRetention(activeDBFile, suffix).apply(policy, sizeBefore, sizeAfter, numKept);
+			if (sizeBefore != sizeAfter) {
+				SimpleLogger::instance()->postMessage(fmt::format("Removing all but {} backup files reducing disk space used from {} to {} bytes", numKept, sizeBefore, sizeAfter));
 			}
 		}
 
@@ -192,6 +344,223 @@ namespace midikraft {
 				//TODO db_.exec("UPDATE schema_version SET number = 7");
 				transaction.commit();
 			}
+			if (currentVersion < 9) {
+				backupIfNecessary(hasBackuped);
+				SQLite::Transaction transaction(db_);
+				createIndexes();
+				db_.exec("UPDATE schema_version SET number = 9");
+				transaction.commit();
+			}
+			if (currentVersion < 10) {
+				backupIfNecessary(hasBackuped);
+				SQLite::Transaction transaction(db_);
+				// The (synth, name) index of version 9 is a prefix of the new one
+				db_.exec("DROP INDEX IF EXISTS patches_synth_name");
+				createIndexes();
+				db_.exec("UPDATE schema_version SET number = 10");
+				transaction.commit();
+			}
+			if (currentVersion < 11) {
+				backupIfNecessary(hasBackuped);
+				SQLite::Transaction transaction(db_);
+				createNameSearchIndex(true);
+				db_.exec("UPDATE schema_version SET number = 11");
+				transaction.commit();
+			}
+			if (currentVersion < 12) {
+				backupIfNecessary(hasBackuped);
+				SQLite::Transaction transaction(db_);
+				createNameCounts();
+				db_.exec("UPDATE schema_version SET number = 12");
+				transaction.commit();
+			}
+			if (currentVersion < 13) {
+				backupIfNecessary(hasBackuped);
+				SQLite::Transaction transaction(db_);
+				createCategoryIndex();
+				db_.exec("UPDATE schema_version SET number = 13");
+				transaction.commit();
+			}
+			if (currentVersion < 14) {
+				backupIfNecessary(hasBackuped);
+				SQLite::Transaction transaction(db_);
+				renumberLists(nullptr);
+				db_.exec("UPDATE schema_version SET number = 14");
+				transaction.commit();
+			}
+		}
+
+		void createCategoryIndex() {
+			// One row per patch and category that is either assigned or a user decision. The bitfield columns stay the storage for the first 63 categories,
+			// every write to them also writes this table. Categories with a higher bit index live here only.
+			// Deleting a patch cleans up by trigger, inserts and updates are written by insertPatch and updatePatch as only they know the higher categories
+			db_.exec("CREATE TABLE IF NOT EXISTS patch_category (synth TEXT NOT NULL, md5 TEXT NOT NULL, bitIndex INTEGER NOT NULL, assigned INTEGER NOT NULL, userDecision INTEGER NOT NULL,"
+				" PRIMARY KEY (synth, md5, bitIndex)) WITHOUT ROWID");
+			db_.exec("CREATE INDEX IF NOT EXISTS patch_category_assigned ON patch_category (bitIndex, synth, md5) WHERE assigned = 1");
+			db_.exec("CREATE TRIGGER IF NOT EXISTS patch_category_delete AFTER DELETE ON patches BEGIN"
+				" DELETE FROM patch_category WHERE synth = old.synth AND md5 = old.md5; END");
+			// Backfill from the bitfields, one row for each bit set in either of them
+			db_.exec("DELETE FROM patch_category");
+			db_.exec(fmt::format("WITH RECURSIVE bits(b) AS (SELECT 0 UNION ALL SELECT b + 1 FROM bits WHERE b < {}) "
+				"INSERT INTO patch_category (synth, md5, bitIndex, assigned, userDecision) "
+				"SELECT synth, md5, b, (coalesce(categories, 0) >> b) & 1, (coalesce(categoryUserDecision, 0) >> b) & 1 FROM patches, bits "
+				"WHERE synth IS NOT NULL AND md5 IS NOT NULL AND ((coalesce(categories, 0) | coalesce(categoryUserDecision, 0)) >> b) & 1 = 1", CategoryBitfield::kBitfieldSize - 1));
+		}
+
+		void checkCategoryIndex() {
+			hasCategoryIndex_ = db_.tableExists("patch_category");
+		}
+
+		void writePatchCategories(std::string const& synth, std::string const& md5, std::set<Category> const& assigned, std::set<Category> const& userDecisions, CategoryCache const& categories, bool replace) {
+			// Call within the transaction writing the bitfields of the patch
+			if (!hasCategoryIndex_) return;
+			if (replace) {
+				auto cachedRemove = statements_.prepare("DELETE FROM patch_category WHERE synth = :SYN AND md5 = :MD5");
+				SQLite::Statement& remove = *cachedRemove;
+				remove.bind(":SYN", synth);
+				remove.bind(":MD5", md5);
+				remove.exec();
+			}
+			std::map<int, std::pair<bool, bool>> rows;
+			for (auto const& cat : assigned) {
+				int bitIndex = categories.bitfield.bitIndexForCategory(cat);
+				if (bitIndex >= 0) rows[bitIndex].first = true;
+			}
+			for (auto const& cat : userDecisions) {
+				int bitIndex = categories.bitfield.bitIndexForCategory(cat);
+				if (bitIndex >= 0) rows[bitIndex].second = true;
+			}
+			auto cachedInsert = statements_.prepare("INSERT OR REPLACE INTO patch_category (synth, md5, bitIndex, assigned, userDecision) VALUES (:SYN, :MD5, :BIT, :ASS, :USD)");
+			SQLite::Statement& insert = *cachedInsert;
+			for (auto const& row : rows) {
+				insert.reset();
+				insert.bind(":SYN", synth);
+				insert.bind(":MD5", md5);
+				insert.bind(":BIT", row.first);
+				insert.bind(":ASS", row.second.first ? 1 : 0);
+				insert.bind(":USD", row.second.second ? 1 : 0);
+				insert.exec();
+			}
+		}
+
+		std::string extendedCategoryColumn(CategoryCache const& categories) const {
+			// Extra column for SELECTs on patches, only needed if there are categories outside of the bitfield. Decode with addExtendedCategories
+			if (!hasCategoryIndex_ || !categories.bitfield.hasExtendedCategories()) {
+				return "";
+			}
+			return fmt::format(", (SELECT group_concat(pc.bitIndex || ':' || pc.assigned || ':' || pc.userDecision) FROM patch_category AS pc"
+				" WHERE pc.synth = patches.synth AND pc.md5 = patches.md5 AND pc.bitIndex >= {}) AS extendedCategories", CategoryBitfield::kBitfieldSize);
+		}
+
+		std::string readExtendedCategories(SQLite::Statement& query, CategoryCache const& categories) const {
+			// The query must have been built with extendedCategoryColumn() for the same cache snapshot
+			if (!hasCategoryIndex_ || !categories.bitfield.hasExtendedCategories()) {
+				return "";
+			}
+			return query.getColumn("extendedCategories").getString(); // Empty for NULL
+		}
+
+		void addExtendedCategories(SQLite::Statement& query, CategoryCache const& categories, std::set<Category>& assigned, std::set<Category>& userDecisions) const {
+			addExtendedCategories(readExtendedCategories(query, categories), categories, assigned, userDecisions);
+		}
+
+		void addExtendedCategories(std::string const& encoded, CategoryCache const& categories, std::set<Category>& assigned, std::set<Category>& userDecisions) const {
+			if (encoded.empty()) {
+				return;
+			}
+			StringArray entries;
+			entries.addTokens(String(encoded), ",", "");
+			for (auto const& entry : entries) {
+				StringArray parts;
+				parts.addTokens(entry, ":", "");
+				if (parts.size() != 3) continue;
+				auto definition = categories.bitfield.definitionForBitIndex(parts[0].getIntValue());
+				if (!definition) continue;
+				if (parts[1].getIntValue() == 1) assigned.insert(Category(definition));
+				if (parts[2].getIntValue() == 1) userDecisions.insert(Category(definition));
+			}
+		}
+
+		void createNameCounts() {
+			// Number of patches per synth and name, and how many of them are not hidden, for the duplicate name filter. 
+			// Maintained by triggers like the name search index, so every insert, delete, rename and hide keeps it current.
+			// Patches without a name are not counted, they never matched the duplicate filter
+			db_.exec("CREATE TABLE IF NOT EXISTS name_counts (synth TEXT NOT NULL, name TEXT NOT NULL, count INTEGER NOT NULL, visible_count INTEGER NOT NULL,"
+				" PRIMARY KEY (synth, name)) WITHOUT ROWID");
+			std::string countNew = " INSERT INTO name_counts (synth, name, count, visible_count) VALUES (new.synth, new.name, 1, coalesce(new.hidden, 0) != 1)"
+				" ON CONFLICT (synth, name) DO UPDATE SET count = count + 1, visible_count = visible_count + excluded.visible_count;";
+			std::string uncountOld = " UPDATE name_counts SET count = count - 1, visible_count = visible_count - (coalesce(old.hidden, 0) != 1) WHERE synth = old.synth AND name = old.name;"
+				" DELETE FROM name_counts WHERE synth = old.synth AND name = old.name AND count <= 0;";
+			db_.exec("CREATE TRIGGER IF NOT EXISTS name_counts_insert AFTER INSERT ON patches WHEN new.synth IS NOT NULL AND new.name IS NOT NULL BEGIN" + countNew + " END");
+			db_.exec("CREATE TRIGGER IF NOT EXISTS name_counts_delete AFTER DELETE ON patches WHEN old.synth IS NOT NULL AND old.name IS NOT NULL BEGIN" + uncountOld + " END");
+			db_.exec("CREATE TRIGGER IF NOT EXISTS name_counts_update_old AFTER UPDATE OF synth, name, hidden ON patches WHEN old.synth IS NOT NULL AND old.name IS NOT NULL BEGIN" + uncountOld + " END");
+			db_.exec("CREATE TRIGGER IF NOT EXISTS name_counts_update_new AFTER UPDATE OF synth, name, hidden ON patches WHEN new.synth IS NOT NULL AND new.name IS NOT NULL BEGIN" + countNew + " END");
+			db_.exec("DELETE FROM name_counts");
+			db_.exec("INSERT INTO name_counts (synth, name, count, visible_count) SELECT synth, name, count(*), sum(coalesce(hidden, 0) != 1) FROM patches"
+				" WHERE synth IS NOT NULL AND name IS NOT NULL GROUP BY synth, name");
+		}
+
+		bool createNameSearchIndex(bool logFailure) {
+			// An external content FTS5 table over patches.name, kept in sync by triggers so no code path writing patches can forget it.
+			// The trigram tokenizer gives substring matches like LIKE '%name%', but it needs SQLite 3.34 compiled with FTS5. If that is not available, name search stays with LIKE.
+			// The index refers to patches by rowid, so anybody running a VACUUM on the database needs to 'rebuild' it afterwards
+			try {
+				db_.exec("SAVEPOINT create_name_index");
+				try {
+					db_.exec("CREATE VIRTUAL TABLE IF NOT EXISTS patch_names USING fts5(name, content='patches', tokenize='trigram')");
+					db_.exec("CREATE TRIGGER IF NOT EXISTS patch_names_insert AFTER INSERT ON patches BEGIN"
+						" INSERT INTO patch_names(rowid, name) VALUES (new.rowid, new.name); END");
+					db_.exec("CREATE TRIGGER IF NOT EXISTS patch_names_delete AFTER DELETE ON patches BEGIN"
+						" INSERT INTO patch_names(patch_names, rowid, name) VALUES ('delete', old.rowid, old.name); END");
+					db_.exec("CREATE TRIGGER IF NOT EXISTS patch_names_update AFTER UPDATE OF name ON patches BEGIN"
+						" INSERT INTO patch_names(patch_names, rowid, name) VALUES ('delete', old.rowid, old.name);"
+						" INSERT INTO patch_names(rowid, name) VALUES (new.rowid, new.name); END");
+					// Index all existing patches
+					db_.exec("INSERT INTO patch_names(patch_names) VALUES ('rebuild')");
+					db_.exec("RELEASE create_name_index");
+					return true;
+				}
+				catch (SQLite::Exception& ex) {
+					db_.exec("ROLLBACK TO create_name_index");
+					db_.exec("RELEASE create_name_index");
+					if (logFailure) {
+						SimpleLogger::instance()->postMessage(fmt::format("Full text index for patch names not available, name search will be slower: {}", ex.what()));
+					}
+				}
+			}
+			catch (SQLite::Exception& ex) {
+				SimpleLogger::instance()->postMessage(fmt::format("DATABASE ERROR in createNameSearchIndex: SQL Exception {}", ex.what()));
+			}
+			return false;
+		}
+
+		void checkNameSearchIndex() {
+			// The index might be missing if the schema was migrated by a build without FTS5 support
+			hasNameSearchIndex_ = db_.tableExists("patch_names");
+			if (!hasNameSearchIndex_ && mode_ != OpenMode::READ_ONLY) {
+				hasNameSearchIndex_ = createNameSearchIndex(false);
+			}
+		}
+
+		bool useNameSearchIndex(std::string const& name) const {
+			// A trigram index can only find search strings of at least three characters
+			return hasNameSearchIndex_ && String::fromUTF8(name.c_str()).length() >= 3;
+		}
+
+		std::string nameSearchExpression(std::string const& name) const {
+			// Quote as a single FTS5 string, so user input is never parsed as query syntax
+			return "\"" + String::fromUTF8(name.c_str()).replace("\"", "\"\"").toStdString() + "\"";
+		}
+
+		void createIndexes() {
+			// Without these, every filter scans the whole patches table. The column order follows the WHERE and ORDER BY clauses built in
+			// buildWhereClause/buildOrderClause, the list join in buildJoinClause and the imports join in getImportsList
+			db_.exec("CREATE INDEX IF NOT EXISTS patches_synth_md5 ON patches (synth, md5)");
+			db_.exec("CREATE INDEX IF NOT EXISTS patches_synth_import ON patches (synth, sourceID, midiBankNo, midiProgramNo)");
+			db_.exec("CREATE INDEX IF NOT EXISTS patches_synth_name_place ON patches (synth, name, midiBankNo, midiProgramNo)");
+			db_.exec("CREATE INDEX IF NOT EXISTS patch_in_list_order ON patch_in_list (id, order_num)");
+			db_.exec("CREATE INDEX IF NOT EXISTS patch_in_list_patch ON patch_in_list (synth, md5)");
+			db_.exec("CREATE INDEX IF NOT EXISTS imports_synth_id ON imports (synth, id)");
 		}
 
 		void insertDefaultCategories() {
@@ -212,6 +581,45 @@ namespace midikraft {
 			db_.exec(String("INSERT INTO categories VALUES (14, 'Voice', '" + Colour::fromString("ffa75781").darker().toString() + "', 1)").toStdString().c_str());
 		}
 
+		bool quickSchemaCheck() {
+			// One statement instead of the table checks of createSchema. PRAGMA user_version only gets stamped after a full createSchema brought the file to SCHEMA_VERSION, 
+			// so a match means all tables exist. The optional indexes are looked up in the same go
+			try {
+				SQLite::Statement query(db_, "SELECT (SELECT user_version FROM pragma_user_version),"
+					" EXISTS (SELECT 1 FROM sqlite_master WHERE type = 'table' AND name = 'patch_names'),"
+					" EXISTS (SELECT 1 FROM sqlite_master WHERE type = 'table' AND name = 'patch_category')");
+				if (!query.executeStep() || query.getColumn(0).getInt() != SCHEMA_VERSION) {
+					return false;
+				}
+				hasNameSearchIndex_ = query.getColumn(1).getInt() != 0;
+				hasCategoryIndex_ = query.getColumn(2).getInt() != 0;
+			}
+			catch (SQLite::Exception& ex) {
+				SimpleLogger::instance()->postMessage(fmt::format("DATABASE ERROR in quickSchemaCheck, doing the full check: SQL Exception {}", ex.what()));
+				return false;
+			}
+			if (!hasNameSearchIndex_ && mode_ != OpenMode::READ_ONLY) {
+				hasNameSearchIndex_ = createNameSearchIndex(false);
+			}
+			return true;
+		}
+
+		void stampSchemaVersion() {
+			// Mirror schema_version into the file header for quickSchemaCheck. Older versions of the program never read it, and a newer SCHEMA_VERSION doesn't match,
+			// so the full check runs whenever a different build has opened the file
+			if (mode_ == OpenMode::READ_ONLY) {
+				return;
+			}
+			try {
+				if (db_.execAndGet("PRAGMA user_version").getInt() != SCHEMA_VERSION) {
+					db_.exec("PRAGMA user_version = " + std::to_string(SCHEMA_VERSION));
+				}
+			}
+			catch (SQLite::Exception& ex) {
+				SimpleLogger::instance()->postMessage(fmt::format("DATABASE ERROR in stampSchemaVersion: SQL Exception {}", ex.what()));
+			}
+		}
+
 		void createSchema() {
 			SQLite::Transaction transaction(db_);
 			if (!db_.tableExists("patches")) {
@@ -270,7 +678,11 @@ namespace midikraft {
 				}
 			}
 			else {
-				// Ups, completely empty database, need to insert current schema version
+				// Ups, completely empty database, need to insert current schema version and create what the migrations would have created
+				createIndexes();
+				createNameSearchIndex(true);
+				createNameCounts();
+				createCategoryIndex();
 				int rows = db_.exec("INSERT INTO schema_version VALUES (" + String(SCHEMA_VERSION).toStdString() + ")");
 				if (rows != 1) {
 					jassert(false);
@@ -281,10 +693,11 @@ namespace midikraft {
 			}
 		}
 
-		bool putPatch(PatchHolder const& patch, std::string const& sourceID) {
+		// Prepare a statement from kInsertPatchSql once and reuse it for all patches of a bulk operation, preparing costs more than executing
+		bool insertPatch(SQLite::Statement& sql, PatchHolder const& patch, std::string const& sourceID, CategoryCache const& categories) {
 			try {
-				SQLite::Statement sql(db_, "INSERT INTO patches (synth, md5, name, type, data, favorite, hidden, sourceID, sourceName, sourceInfo, midiBankNo, midiProgramNo, categories, categoryUserDecision)"
-					" VALUES (:SYN, :MD5, :NAM, :TYP, :DAT, :FAV, :HID, :SID, :SNM, :SRC, :BNK, :PRG, :CAT, :CUD)");
+				sql.reset();
+				sql.clearBindings();
 
 				// Insert values into prepared statement
 				sql.bind(":SYN", patch.synth()->getName().c_str());
@@ -299,13 +712,15 @@ namespace midikraft {
 				sql.bind(":SRC", patch.sourceInfo()->toString());
 				sql.bind(":BNK", patch.bankNumber().isValid() ? patch.bankNumber().toZeroBased() : 0);
 				sql.bind(":PRG", patch.patchNumber().toZeroBasedWithBank());
-				sql.bind(":CAT", bitfield.categorySetAsBitfield(patch.categories()));
-				sql.bind(":CUD", bitfield.categorySetAsBitfield(patch.userDecisionSet()));
+				sql.bind(":CAT", categories.bitfield.categorySetAsBitfield(patch.categories()));
+				sql.bind(":CUD", categories.bitfield.categorySetAsBitfield(patch.userDecisionSet()));
 
 				sql.exec();
+				writePatchCategories(patch.synth()->getName(), patch.md5(), patch.categories(), patch.userDecisionSet(), categories, false);
 			}
 			catch (SQLite::Exception& ex) {
-				SimpleLogger::instance()->postMessage(fmt::format("DATABASE ERROR in putPatch: SQL Exception {}", ex.what()));
+				SimpleLogger::instance()->postMessage(fmt::format("DATABASE ERROR in insertPatch: SQL Exception {}", ex.what()));
+				return false;
 			}
 			return true;
 		}
@@ -330,6 +745,7 @@ namespace midikraft {
 				if (rowsModified == 1) {
 					// Success
 					transaction.commit();
+					patchesChanged();
 					return true;
 				}
 				else if (rowsModified == 0) {
@@ -363,9 +779,14 @@ namespace midikraft {
 				where += " AND sourceID = :SID";
 			}
 			if (!filter.name.empty()) {
-				where += " AND name LIKE :NAM";
-				if (needsCollate) {
-					where += " COLLATE NOCASE";
+				if (useNameSearchIndex(filter.name)) {
+					where += " AND patches.rowid IN (SELECT rowid FROM patch_names WHERE patch_names MATCH :NAM)";
+				}
+				else {
+					where += " AND name LIKE :NAM";
+					if (needsCollate) {
+						where += " COLLATE NOCASE";
+					}
 				}
 			}
 			if (!filter.listID.empty()) {
@@ -381,13 +802,32 @@ namespace midikraft {
 				where += " AND (hidden is null or hidden != 1)";
 			}
 			if (filter.onlyUntagged) {
-				where += " AND categories == 0";
+				if (hasCategoryIndex_) {
+					where += " AND NOT EXISTS (SELECT 1 FROM patch_category AS pc WHERE pc.synth = patches.synth AND pc.md5 = patches.md5 AND pc.assigned = 1)";
+				}
+				else {
+					where += " AND categories == 0";
+				}
+			}
+			else if (!filter.categories.empty() && hasCategoryIndex_) {
+				// Patches having any (OR) or all (AND) of the categories, driven by the patch_category_assigned index
+				std::string subquery;
+				if (!filter.andCategories) {
+					std::string variables;
+					for (size_t c = 0; c < filter.categories.size(); c++) {
+						variables += (c == 0 ? "" : ", ") + categoryVariable(c);
+					}
+					subquery = "SELECT synth, md5 FROM patch_category WHERE assigned = 1 AND bitIndex IN (" + variables + ")";
+				}
+				else {
+					for (size_t c = 0; c < filter.categories.size(); c++) {
+						subquery += (c == 0 ? "" : " INTERSECT ") + std::string("SELECT synth, md5 FROM patch_category WHERE assigned = 1 AND bitIndex = ") + categoryVariable(c);
+					}
+				}
+				where += " AND (patches.synth, patches.md5) IN (" + subquery + ")";
 			}
 			else if (!filter.categories.empty()) {
-				// Empty category filter set will of course return everything
-				//TODO this has bad query performance as it will force a table scan, but for now I cannot see this becoming a problem as long as the database is not multi-tenant
-				// The correct way to do this would be to create a many to many relationship and run an "exists" query or join/unique the category table. Returning the list of categories also requires 
-				// a concat on sub-query, so we're running into more complex SQL territory here.
+				// Fallback for databases without the patch_category table, this forces a table scan. Empty category filter set will of course return everything
 				if (!filter.andCategories) {
 					where += " AND (categories & :CAT != 0)";
 				}
@@ -422,14 +862,19 @@ namespace midikraft {
 				joinClause += " INNER JOIN patch_in_list ON patches.md5 = patch_in_list.md5 AND patches.synth = patch_in_list.synth";
 			}
 			if (filter.onlyDuplicateNames) {
+				// The aliases keep name and synth unambiguous for the rest of the query. SQLite flattens the subquery into a lookup on the primary key of name_counts
 				if (filter.showHidden)
-					joinClause += " JOIN (select name as dup_name, synth, count(*) as name_count from patches group by dup_name, synth) as ordinal_table on patches.name = ordinal_table.dup_name and patches.synth = ordinal_table.synth";
+					joinClause += " JOIN (select synth as dup_synth, name as dup_name, count as name_count from name_counts) as ordinal_table on patches.name = ordinal_table.dup_name and patches.synth = ordinal_table.dup_synth";
 				else
-					joinClause += " JOIN (select name as dup_name, synth, count(*) as name_count from patches where hidden = 0 group by dup_name, synth) as ordinal_table on patches.name = ordinal_table.dup_name and patches.synth = ordinal_table.synth";
+					joinClause += " JOIN (select synth as dup_synth, name as dup_name, visible_count as name_count from name_counts) as ordinal_table on patches.name = ordinal_table.dup_name and patches.synth = ordinal_table.dup_synth";
 			}
 			return joinClause;
 		}
 
+		std::string categoryVariable(size_t no) {
+			return fmt::format(":C{:02d}", no);
+		}
+
 		std::string synthVariable(int no) {
 			// Calculate a variable name to bind the synth name to. This will blow up if you query for more than 99 synths.
 			return fmt::format(":S{:02d}", no);
@@ -447,23 +892,97 @@ namespace midikraft {
 				query.bind(":LID", filter.listID);
 			}
 			if (!filter.name.empty()) {
-				query.bind(":NAM", "%" + filter.name + "%");
+				if (useNameSearchIndex(filter.name)) {
+					query.bind(":NAM", nameSearchExpression(filter.name));
+				}
+				else {
+					query.bind(":NAM", "%" + filter.name + "%");
+				}
 			}
 			if (filter.onlySpecifcType) {
 				query.bind(":TYP", filter.typeID);
 			}
 			if (!filter.onlyUntagged && !filter.categories.empty()) {
-				query.bind(":CAT", bitfield.categorySetAsBitfield(filter.categories));
+				auto categories = categoryCache();
+				if (hasCategoryIndex_) {
+					int c = 0;
+					for (auto const& cat : filter.categories) {
+						query.bind(categoryVariable(c++), categories->bitfield.bitIndexForCategory(cat));
+					}
+				}
+				else {
+					query.bind(":CAT", categories->bitfield.categorySetAsBitfield(filter.categories));
+				}
+			}
+		}
+
+		void flagFullTableScans(SQLite::Database& db, std::string const& sql, PatchFilter const& filter, std::function<void(SQLite::Statement&)> bindParameters) {
+			// Run EXPLAIN QUERY PLAN and complain if the patches table is scanned although we filter by synth, which means an index is missing or unusable.
+			// Each query shape is only reported once
+			ScopedLock lock(reportedFullScansLock_);
+			if (filter.synths.empty() || reportedFullScans_.find(sql) != reportedFullScans_.end()) {
+				return;
+			}
+			try {
+				SQLite::Statement explain(db, "EXPLAIN QUERY PLAN " + sql);
+				bindParameters(explain);
+				while (explain.executeStep()) {
+					// Depending on the SQLite version, the detail reads "SCAN TABLE patches" or "SCAN patches"
+					std::string detail = explain.getColumn("detail").getString();
+					if ((detail.rfind("SCAN patches", 0) == 0 || detail.rfind("SCAN TABLE patches", 0) == 0) && detail.find("USING") == std::string::npos) {
+						reportedFullScans_.insert(sql);
+						SimpleLogger::instance()->postMessage(fmt::format("Performance warning - query does a full table scan of patches ({}): {}", detail, sql));
+						return;
+					}
+				}
+			}
+			catch (SQLite::Exception& ex) {
+				SimpleLogger::instance()->postMessage(fmt::format("DATABASE ERROR in flagFullTableScans: SQL Exception {}", ex.what()));
+			}
+		}
+
+		// The parameters are only described for the slow query log, so nothing is formatted for the fast statements
+		void statementFinished(SQLite::Database& db, SQLite::Statement& query, std::string const& operation, std::string const& sql, std::function<std::string()> const& describeParameters,
+			double startTime, uint64 rowsRead, std::function<void(SQLite::Statement&)> bindParameters) {
+			DatabaseInstrumentation::statementDone(query, rowsRead);
+			double elapsed = Time::getMillisecondCounterHiRes() - startTime;
+			if (instrumentation_.isSlow(elapsed)) {
+				instrumentation_.recordSlowQuery(db, operation, sql, describeParameters(), elapsed, bindParameters);
 			}
 		}
 
 		int getPatchesCount(PatchFilter filter) {
+			if (auto snapshot = snapshotFor(filter)) {
+				return snapshot->count(filter, categoryCache()->bitfield);
+			}
+			auto key = filterCacheKey(filter);
+			auto generations = currentGenerations();
+			int count;
+			if (queryCache_.lookupCount(key, generations, count)) {
+				return count;
+			}
 			try {
 				std::string queryString = "SELECT count(*) FROM patches" + buildJoinClause(filter) + buildWhereClause(filter, false);
-				SQLite::Statement query(db_, queryString);
+#if JUCE_DEBUG
+				flagFullTableScans(db_, queryString, filter, [&](SQLite::Statement& explain) { bindWhereClause(explain, filter); });
+#endif
+				double startTime = Time::getMillisecondCounterHiRes();
+				auto cachedQuery = statements_.prepare(queryString);
+				SQLite::Statement& query = *cachedQuery;
 				bindWhereClause(query, filter);
-				if (query.executeStep()) {
-					int count = query.getColumn(0).getInt();
+				bool hasRow;
+				try {
+					hasRow = query.executeStep();
+				}
+				catch (...) {
+					// Reset the counters of the cached statement, else its next execution is charged with them
+					DatabaseInstrumentation::statementDone(query, 0);
+					throw;
+				}
+				if (hasRow) {
+					count = query.getColumn(0).getInt();
+					statementFinished(db_, query, "getPatchesCount", queryString, [&key]() { return key; }, startTime, 1, [&](SQLite::Statement& explain) { bindWhereClause(explain, filter); });
+					queryCache_.storeCount(key, dependsOnLists(filter), generations, count);
 					return count;
 				}
 			}
@@ -473,7 +992,175 @@ namespace midikraft {
 			return 0;
 		}
 
-		std::vector<Category> getCategories() {
+		QueryResultCache::Generations currentGenerations() const {
+			// Read before running a query, so a write committing while the query runs makes its result stale instead of hiding the write
+			return { patchGeneration_.load(), listGeneration_.load() };
+		}
+
+		// Call these after the write has been committed
+		void patchesChanged() {
+			patchGeneration_++;
+			refreshSnapshot();
+		}
+
+		void openSnapshot() {
+			// The temp triggers only see the writes of this connection, which are all writes of this process. Nothing else should write to the database
+			// file while it is open, the snapshot would not notice
+			try {
+				if (mode_ != OpenMode::READ_ONLY) {
+					db_.exec("CREATE TEMP TABLE IF NOT EXISTS snapshot_changes (id INTEGER PRIMARY KEY)");
+					db_.exec("CREATE TEMP TRIGGER IF NOT EXISTS snapshot_patches_insert AFTER INSERT ON main.patches BEGIN INSERT OR IGNORE INTO snapshot_changes VALUES (new.rowid); END");
+					db_.exec("CREATE TEMP TRIGGER IF NOT EXISTS snapshot_patches_update AFTER UPDATE ON main.patches BEGIN"
+						" INSERT OR IGNORE INTO snapshot_changes VALUES (old.rowid); INSERT OR IGNORE INTO snapshot_changes VALUES (new.rowid); END");
+					db_.exec("CREATE TEMP TRIGGER IF NOT EXISTS snapshot_patches_delete AFTER DELETE ON main.patches BEGIN INSERT OR IGNORE INTO snapshot_changes VALUES (old.rowid); END");
+					if (hasCategoryIndex_) {
+						// The categories outside of the bitfield are only written to patch_category
+						auto touchPatch = [](std::string const& row) {
+							return " INSERT OR IGNORE INTO snapshot_changes SELECT rowid FROM main.patches WHERE synth = " + row + ".synth AND md5 = " + row + ".md5;";
+						};
+						db_.exec("CREATE TEMP TRIGGER IF NOT EXISTS snapshot_category_insert AFTER INSERT ON main.patch_category BEGIN" + touchPatch("new") + " END");
+						db_.exec("CREATE TEMP TRIGGER IF NOT EXISTS snapshot_category_update AFTER UPDATE ON main.patch_category BEGIN" + touchPatch("old") + touchPatch("new") + " END");
+						db_.exec("CREATE TEMP TRIGGER IF NOT EXISTS snapshot_category_delete AFTER DELETE ON main.patch_category BEGIN" + touchPatch("old") + " END");
+					}
+				}
+				auto snapshot = std::make_shared<PatchSnapshot>(workerPool());
+				snapshot->load(db_, hasCategoryIndex_);
+				std::atomic_store(&snapshot_, snapshot);
+			}
+			catch (SQLite::Exception& ex) {
+				SimpleLogger::instance()->postMessage(fmt::format("DATABASE ERROR in openSnapshot: SQL Exception {}", ex.what()));
+			}
+		}
+
+		void refreshSnapshot() {
+			// Inside of a transaction the changes are not final yet, they are picked up by the call after the commit. A rollback also removes them from snapshot_changes
+			auto snapshot = std::atomic_load(&snapshot_);
+			if (!snapshot || mode_ == OpenMode::READ_ONLY || !sqlite3_get_autocommit(db_.getHandle())) {
+				return;
+			}
+			try {
+				std::vector<int64> changed;
+				SQLite::Statement query(db_, "SELECT id FROM temp.snapshot_changes");
+				while (query.executeStep()) {
+					changed.push_back(query.getColumn(0).getInt64());
+				}
+				snapshot->refresh(db_, hasCategoryIndex_, changed);
+				db_.exec("DELETE FROM temp.snapshot_changes");
+			}
+			catch (SQLite::Exception& ex) {
+				// The snapshot might now miss a change, don't answer from it anymore
+				SimpleLogger::instance()->postMessage(fmt::format("DATABASE ERROR in refreshSnapshot: SQL Exception {}, switching off the snapshot", ex.what()));
+				std::atomic_store(&snapshot_, std::shared_ptr<PatchSnapshot>());
+			}
+		}
+
+		std::shared_ptr<PatchSnapshot> snapshotFor(PatchFilter const& filter) const {
+			// Null if there is no snapshot or it can't evaluate the filter
+			auto snapshot = std::atomic_load(&snapshot_);
+			if (snapshot && PatchSnapshot::canEvaluate(filter, categoryCache()->bitfield)) {
+				return snapshot;
+			}
+			return nullptr;
+		}
+
+		bool getPatchIds(PatchFilter filter, std::vector<int64>& outIds, int skip, int limit) {
+			auto snapshot = snapshotFor(filter);
+			if (!snapshot) {
+				return false;
+			}
+			outIds = snapshot->ids(filter, categoryCache()->bitfield, skip, limit);
+			return true;
+		}
+
+		bool loadPatchesById(SQLite::Database& db, std::vector<int64> const& ids, std::map<std::string, std::weak_ptr<Synth>> synths, std::vector<PatchHolder>& result,
+			std::vector<std::pair<std::string, PatchHolder>>& needsReindexing) {
+			// Rows of synths not given and rows deleted in the meantime are skipped, the rest is returned in the order of the ids
+			std::map<int64, PatchHolder> loaded;
+			auto categories = categoryCache();
+			RawPatchRow scratch;
+			for (size_t chunkStart = 0; chunkStart < ids.size(); chunkStart += kLookupChunkSize) {
+				size_t chunkEnd = std::min(chunkStart + kLookupChunkSize, ids.size());
+				try {
+					auto cachedQuery = statementsFor(db).prepare("SELECT rowid AS patch_rowid, *" + extendedCategoryColumn(*categories) + " FROM patches WHERE rowid IN (" + placeholderList(chunkEnd - chunkStart) + ")");
+					SQLite::Statement& query = *cachedQuery;
+					for (size_t i = chunkStart; i < chunkEnd; i++) {
+						query.bind((int)(i - chunkStart + 1), (long long)ids[i]);
+					}
+					uint64 rowsRead = 0;
+					while (query.executeStep()) {
+						rowsRead++;
+						auto synth = synths.find(query.getColumn("synth").getString());
+						if (synth == synths.end()) {
+							continue;
+						}
+						std::vector<PatchHolder> patch;
+						if (loadPatchFromQueryRow(synth->second.lock(), query, *categories, scratch, patch)) {
+							// Check if the MD5 is the correct one (the algorithm might have changed!)
+							std::string md5stored = query.getColumn("md5");
+							if (patch.back().md5() != md5stored) {
+								needsReindexing.emplace_back(md5stored, patch.back());
+							}
+							loaded.emplace(query.getColumn("patch_rowid").getInt64(), patch.back());
+						}
+					}
+					DatabaseInstrumentation::statementDone(query, rowsRead);
+				}
+				catch (SQLite::Exception& ex) {
+					SimpleLogger::instance()->postMessage(fmt::format("DATABASE ERROR in loadPatchesById: SQL Exception {}", ex.what()));
+					return false;
+				}
+			}
+			for (auto id : ids) {
+				auto found = loaded.find(id);
+				if (found != loaded.end()) {
+					result.push_back(found->second);
+				}
+			}
+			return true;
+		}
+
+		std::vector<PatchHolder> loadPatchesById(std::vector<int64> const& ids, std::map<std::string, std::weak_ptr<Synth>> synths) {
+			std::vector<PatchHolder> result;
+			std::vector<std::pair<std::string, PatchHolder>> needsReindexing;
+			loadPatchesById(db_, ids, synths, result, needsReindexing);
+			return result;
+		}
+
+		void listsChanged() {
+			listGeneration_++;
+		}
+
+		static bool dependsOnLists(PatchFilter const& filter) {
+			return !filter.listID.empty() || filter.orderBy == PatchOrdering::Order_by_Place_in_List;
+		}
+
+		QueryCacheStats queryCacheStats() const {
+			return queryCache_.stats();
+		}
+
+		void setQueryCacheSize(size_t entries) {
+			queryCache_.setCapacity(entries);
+		}
+
+		std::shared_ptr<const CategoryCache> categoryCache() const {
+			// Loaders take one snapshot per query and use it for all rows, so they never need to lock or go back to the database
+			return std::atomic_load(&categoryCache_);
+		}
+
+		std::vector<Category> getCategories() const {
+			return categoryCache()->categories;
+		}
+
+		uint64 categoryReloadCount() const {
+			return categoryReloads_.load();
+		}
+
+		DatabaseOpenTimings openTimings() const {
+			return openTimings_;
+		}
+
+		void reloadCategories() {
+			// This is the only place that reads the categories table. Call it only when the table might have changed
 			ScopedLock lock(categoryLock_);
 			SQLite::Statement query(db_, "SELECT * FROM categories ORDER BY bitIndex");
 			std::vector<std::shared_ptr<CategoryDefinition>> activeDefinitions;
@@ -484,38 +1171,26 @@ namespace midikraft {
 				auto colorName = query.getColumn("color").getText();
 				bool isActive = query.getColumn("active").getInt() != 0;
 
-				// Check if this already exists!
-				bool found = false;
-				for (auto exists : categoryDefinitions_) {
-					if (exists.def()->id == bitIndex) {
-						found = true;
-						exists.def()->color = Colour::fromString(colorName);
-						exists.def()->name = name;
-						exists.def()->isActive = isActive;
-						allCategories.push_back(exists);
-						if (isActive) {
-							activeDefinitions.emplace_back(exists.def());
-						}
-						break;
-					}
-				}
-				if (!found) {
-					auto def = std::make_shared<CategoryDefinition>(CategoryDefinition({ bitIndex, isActive, name, Colour::fromString(colorName) }));
-					allCategories.push_back(Category(def));
-					if (isActive) {
-						activeDefinitions.emplace_back(def);
-					}
+				// Always new definitions, the ones of the previous snapshot are still read by other threads without a lock.
+				// Categories handed out before keep working, as the bitfield resolves them by their id and not by their name
+				auto def = std::make_shared<CategoryDefinition>(CategoryDefinition({ bitIndex, isActive, name, Colour::fromString(colorName) }));
+				allCategories.push_back(Category(def));
+				if (isActive) {
+					activeDefinitions.emplace_back(def);
 				}
 			}
-			bitfield = CategoryBitfield(activeDefinitions); //TODO smell, side effect
-			return allCategories;
+			auto fresh = std::make_shared<CategoryCache>();
+			fresh->version = ++categoryReloads_;
+			fresh->categories = allCategories;
+			fresh->bitfield = CategoryBitfield(activeDefinitions);
+			std::atomic_store(&categoryCache_, std::shared_ptr<const CategoryCache>(fresh));
 		}
 
 		int getNextBitindex() {
 			SQLite::Statement query(db_, "SELECT MAX(bitIndex) + 1 as maxbitindex FROM categories");
 			if (query.executeStep()) {
 				int maxbitindex = query.getColumn("maxbitindex").getInt();
-				if (maxbitindex < 63) {
+				if (maxbitindex < CategoryBitfield::kBitfieldSize || hasCategoryIndex_) {
 					// That'll work!
 					return maxbitindex;
 				}
@@ -557,7 +1232,9 @@ namespace midikraft {
 				}
 				transaction.commit();
 				// Refresh our internal data 
-				categoryDefinitions_ = getCategories();
+				reloadCategories();
+				// Loaded patches carry the category definitions, so all cached pages are outdated
+				patchesChanged();
 			}
 			catch (SQLite::Exception& ex) {
 				SimpleLogger::instance()->postMessage(fmt::format("DATABASE ERROR in updateCategories: SQL Exception {}", ex.what()));
@@ -566,69 +1243,122 @@ namespace midikraft {
 
 		void loadBankAndProgram(std::shared_ptr<Synth> synth, SQLite::Statement& query, MidiBankNumber& outBank, MidiProgramNumber& outProgram)
 		{
-			// Determine Bank (if stored) and Program 
 			auto bankCol = query.getColumn("midiBankNo");
-			int midiProgramNumber = query.getColumn("midiProgramNo").getInt();
-			if (bankCol.isNull()) {
+			bankAndProgram(synth, bankCol.isNull() ? -1 : bankCol.getInt(), query.getColumn("midiProgramNo").getInt(), outBank, outProgram);
+		}
+
+		void bankAndProgram(std::shared_ptr<Synth> synth, int midiBankNumber, int midiProgramNumber, MidiBankNumber& outBank, MidiProgramNumber& outProgram)
+		{
+			// Determine Bank (if stored, else -1) and Program 
+			if (midiBankNumber < 0) {
 				outBank = MidiBankNumber::invalid();
 				outProgram = MidiProgramNumber::fromZeroBase(midiProgramNumber);
 			}
 			else {
-				outBank = MidiBankNumber::fromZeroBase(bankCol.getInt(), SynthBank::numberOfPatchesInBank(synth, bankCol.getInt()));
+				outBank = MidiBankNumber::fromZeroBase(midiBankNumber, SynthBank::numberOfPatchesInBank(synth, midiBankNumber));
 				outProgram = MidiProgramNumber::fromZeroBaseWithBank(outBank, midiProgramNumber);
 			}
 		}
 
-		bool loadPatchFromQueryRow(std::shared_ptr<Synth> synth, SQLite::Statement& query, std::vector<PatchHolder>& result) {
-			ScopedLock lock(categoryLock_);
-
-			std::shared_ptr<DataFile> newPatch;
+		// One row of a patches query copied out of the statement, so it can be decoded later and on another thread than the one stepping the statement.
+		// Reusing the same instance for many rows reuses the capacity of the data buffer and the strings
+		struct RawPatchRow {
+			std::shared_ptr<Synth> synth;
+			Synth::PatchData data;
+			bool hasData = false;
+			std::string md5;
+			std::string name;
+			std::string sourceID;
+			std::string sourceInfo;
+			bool hasSourceInfo = false;
+			int favorite = -1; // -1 if not stored
+			int hidden = -1; // -1 if not stored
+			int64 categories = 0;
+			int64 userDecisions = 0;
+			std::string extendedCategories;
+			int midiBankNo = -1; // -1 if not stored
+			int midiProgramNo = 0;
+		};
+
+		void readMetadataColumns(SQLite::Statement& query, CategoryCache const& categories, RawPatchRow& row) {
+			// The query needs to select name, sourceID, favorite, hidden, categories and categoryUserDecision
+			row.name = query.getColumn("name").getString();
+			row.sourceID = query.getColumn("sourceID").getString();
+			auto favoriteColumn = query.getColumn("favorite");
+			row.favorite = favoriteColumn.isInteger() ? favoriteColumn.getInt() : -1;
+			/*auto typeColumn = query.getColumn("type");
+			if (typeColumn.isInteger()) {
+				holder.setType(typeColumn.getInt());
+			}*/
+			auto hiddenColumn = query.getColumn("hidden");
+			row.hidden = hiddenColumn.isInteger() ? hiddenColumn.getInt() : -1;
+			row.categories = query.getColumn("categories").getInt64();
+			row.userDecisions = query.getColumn("categoryUserDecision").getInt64();
+			row.extendedCategories = readExtendedCategories(query, categories);
+		}
 
-			// Create the patch itself, from the BLOB stored
+		void readPatchRow(std::shared_ptr<Synth> synth, SQLite::Statement& query, CategoryCache const& categories, RawPatchRow& row) {
+			row.synth = synth;
 			auto dataColumn = query.getColumn("data");
+			row.hasData = dataColumn.isBlob();
+			if (row.hasData) {
+				auto blob = (uint8 const*)dataColumn.getBlob();
+				row.data.assign(blob, blob + dataColumn.getBytes());
+				DatabaseInstrumentation::blobRead((size_t)dataColumn.getBytes());
+			}
+			row.md5 = query.getColumn("md5").getString();
+			auto sourceColumn = query.getColumn("sourceInfo");
+			row.hasSourceInfo = sourceColumn.isText();
+			row.sourceInfo = row.hasSourceInfo ? sourceColumn.getString() : std::string();
+			auto bankCol = query.getColumn("midiBankNo");
+			row.midiBankNo = bankCol.isNull() ? -1 : bankCol.getInt();
+			row.midiProgramNo = query.getColumn("midiProgramNo").getInt();
+			readMetadataColumns(query, categories, row);
+		}
+
+		void applyMetadata(RawPatchRow const& row, CategoryCache const& categories, PatchHolder& holder) const {
+			// Everything but the patch data itself
+			holder.setName(row.name);
+			holder.setSourceId(row.sourceID);
+			if (row.favorite != -1) {
+				holder.setFavorite(Favorite(row.favorite));
+			}
+			if (row.hidden != -1) {
+				holder.setHidden(row.hidden == 1);
+			}
+			std::set<Category> assigned;
+			std::set<Category> userDecisions;
+			categories.bitfield.makeSetOfCategoriesFromBitfield(assigned, row.categories);
+			categories.bitfield.makeSetOfCategoriesFromBitfield(userDecisions, row.userDecisions);
+			addExtendedCategories(row.extendedCategories, categories, assigned, userDecisions);
+			holder.setCategories(assigned);
+			holder.setUserDecisions(userDecisions);
+		}
 
+		void loadMetadataFromQueryRow(SQLite::Statement& query, CategoryCache const& categories, PatchHolder& holder) {
+			RawPatchRow row;
+			readMetadataColumns(query, categories, row);
+			applyMetadata(row, categories, holder);
+		}
+
+		bool decodePatchRow(RawPatchRow const& row, CategoryCache const& categories, std::vector<PatchHolder>& result) {
+			// Creates the patch via the synth, the expensive part of loading. Doesn't touch the database, so this can run on any thread
+			std::shared_ptr<DataFile> newPatch;
 
 			MidiProgramNumber program;
 			MidiBankNumber bank = MidiBankNumber::invalid();
-			loadBankAndProgram(synth, query, bank, program);
+			bankAndProgram(row.synth, row.midiBankNo, row.midiProgramNo, bank, program);
 
-			// Load the BLOB
-			if (dataColumn.isBlob()) {
-				std::vector<uint8> patchData((uint8*)dataColumn.getBlob(), ((uint8*)dataColumn.getBlob()) + dataColumn.getBytes());
+			// Create the patch itself, from the BLOB stored
+			if (row.hasData) {
 				//TODO I should not need the midiProgramNumber here
-				newPatch = synth->patchFromPatchData(patchData, program);
+				newPatch = row.synth->patchFromPatchData(row.data, program);
 			}
 
-			// We need the current categories
-			categoryDefinitions_ = getCategories();
 			if (newPatch) {
-				auto sourceColumn = query.getColumn("sourceInfo");
-				if (sourceColumn.isText()) {
-					PatchHolder holder(synth, SourceInfo::fromString(sourceColumn.getString()), newPatch, bank, program);
-
-					std::string patchName = query.getColumn("name").getString();
-					holder.setName(patchName);
-					std::string sourceId = query.getColumn("sourceID");
-					holder.setSourceId(sourceId);
-
-					auto favoriteColumn = query.getColumn("favorite");
-					if (favoriteColumn.isInteger()) {
-						holder.setFavorite(Favorite(favoriteColumn.getInt()));
-					}
-					/*auto typeColumn = query.getColumn("type");
-					if (typeColumn.isInteger()) {
-						holder.setType(typeColumn.getInt());
-					}*/
-					auto hiddenColumn = query.getColumn("hidden");
-					if (hiddenColumn.isInteger()) {
-						holder.setHidden(hiddenColumn.getInt() == 1);
-					}
-					std::set<Category> updateSet;
-					bitfield.makeSetOfCategoriesFromBitfield(updateSet, query.getColumn("categories").getInt64());
-					holder.setCategories(updateSet);
-					bitfield.makeSetOfCategoriesFromBitfield(updateSet, query.getColumn("categoryUserDecision").getInt64());
-					holder.setUserDecisions(updateSet);
-
+				if (row.hasSourceInfo) {
+					PatchHolder holder(row.synth, SourceInfo::fromString(row.sourceInfo), newPatch, bank, program);
+					applyMetadata(row, categories, holder);
 					result.push_back(holder);
 					return true;
 				}
@@ -636,94 +1366,556 @@ namespace midikraft {
 					jassert(false);
 				}
 			}
-			else {
-				jassert(false);
+			else {
+				jassert(false);
+			}
+			return false;
+		}
+
+		bool loadPatchFromQueryRow(std::shared_ptr<Synth> synth, SQLite::Statement& query, CategoryCache const &categories, std::vector<PatchHolder>& result) {
+			RawPatchRow scratch;
+			return loadPatchFromQueryRow(synth, query, categories, scratch, result);
+		}
+
+		bool loadPatchFromQueryRow(std::shared_ptr<Synth> synth, SQLite::Statement& query, CategoryCache const &categories, RawPatchRow &scratch, std::vector<PatchHolder>& result) {
+			// Pass the same scratch row for all rows of a query. The BLOB is copied into it without allocating once its capacity has grown to the biggest patch,
+			// which leaves the copy made by the synth into the new patch as the only allocation per patch
+			readPatchRow(synth, query, categories, scratch);
+			return decodePatchRow(scratch, categories, result);
+		}
+
+		bool getSinglePatch(std::shared_ptr<Synth> synth, std::string const& md5, std::vector<PatchHolder>& result) {
+			try {
+				auto categories = categoryCache();
+				auto cachedQuery = statements_.prepare("SELECT *" + extendedCategoryColumn(*categories) + " FROM patches WHERE md5 = :MD5 and synth = :SYN");
+				SQLite::Statement& query = *cachedQuery;
+				query.bind(":SYN", synth->getName());
+				query.bind(":MD5", md5);
+				if (query.executeStep()) {
+					return loadPatchFromQueryRow(synth, query, *categories, result);
+				}
+			}
+			catch (SQLite::Exception& ex) {
+				SimpleLogger::instance()->postMessage(fmt::format("DATABASE ERROR in getSinglePatch: SQL Exception {}", ex.what()));
+			}
+			return false;
+		}
+
+		struct SortKeyColumn {
+			std::string expression;
+			bool isText;
+		};
+
+		std::vector<SortKeyColumn> sortKeyColumns(PatchOrdering orderBy) {
+			// The same order as buildOrderClause, plus a rowid as tie breaker so the key identifies each row uniquely
+			switch (orderBy) {
+			case PatchOrdering::No_ordering: return { { "patches.rowid", false } };
+			case PatchOrdering::Order_by_Import_id: return { { "sourceID", true }, { "midiBankNo", false }, { "midiProgramNo", false }, { "patches.rowid", false } };
+			case PatchOrdering::Order_by_Name: return { { "name", true }, { "midiBankNo", false }, { "midiProgramNo", false }, { "patches.rowid", false } };
+			case PatchOrdering::Order_by_Place_in_List: return { { "order_num", false }, { "patch_in_list.rowid", false } };
+			default:
+				jassertfalse;
+				SimpleLogger::instance()->postMessage("Program error - encountered invalid ordering field in sortKeyColumns");
+				return { { "patches.rowid", false } };
+			}
+		}
+
+		std::string sortKeyVariable(size_t no) {
+			return fmt::format(":K{}", no);
+		}
+
+		std::string buildSeekClause(std::vector<SortKeyColumn> const& columns, PatchPageToken const& page) {
+			// Select only rows sorting after the last row of the previous page. A row value comparison can be resolved by an index seek, 
+			// but yields NULL when a NULL is compared. With a NULL in the last key (only midiBankNo of old databases), spell it out with NULL sorting first
+			if (page.lastKey.empty()) {
+				return "";
+			}
+			jassert(page.lastKey.size() == columns.size());
+			bool hasNull = std::any_of(page.lastKey.begin(), page.lastKey.end(), [](var const& v) { return v.isVoid(); });
+			std::string seek = " AND ";
+			if (!hasNull) {
+				std::string left, right;
+				for (size_t i = 0; i < columns.size(); i++) {
+					left = prependWithComma(left, columns[i].expression);
+					right = prependWithComma(right, sortKeyVariable(i));
+				}
+				seek += "((" + left + ") > (" + right + "))";
+			}
+			else {
+				seek += "(";
+				for (size_t i = 0; i < columns.size(); i++) {
+					if (i != 0) seek += " OR ";
+					seek += "(";
+					for (size_t j = 0; j < i; j++) {
+						seek += columns[j].expression + (page.lastKey[j].isVoid() ? " IS NULL" : " = " + sortKeyVariable(j)) + " AND ";
+					}
+					seek += columns[i].expression + (page.lastKey[i].isVoid() ? " IS NOT NULL" : " > " + sortKeyVariable(i));
+					seek += ")";
+				}
+				seek += ")";
+			}
+			return seek;
+		}
+
+		void bindSeekClause(SQLite::Statement& query, std::vector<SortKeyColumn> const& columns, PatchPageToken const& page) {
+			for (size_t i = 0; i < page.lastKey.size(); i++) {
+				auto const& value = page.lastKey[i];
+				if (value.isVoid()) {
+					// Not used in the statement, see buildSeekClause
+				}
+				else if (columns[i].isText) {
+					query.bind(sortKeyVariable(i), value.toString().toStdString());
+				}
+				else {
+					query.bind(sortKeyVariable(i), (int64)value);
+				}
+			}
+		}
+
+		var sortKeyValue(SQLite::Column const& column) {
+			if (column.isNull()) {
+				return var();
+			}
+			else if (column.isText()) {
+				return var(String(column.getString()));
+			}
+			return var((int64)column.getInt64());
+		}
+
+		struct QueryControl {
+			std::function<bool()> shouldAbort; // Checked before every row, an aborted query returns false and leaves the page token untouched
+			size_t chunkSize = 0;
+			std::function<void(std::vector<PatchHolder>&&)> chunkLoaded; // If set, gets the decoded patches handed over every chunkSize patches and at the end
+			bool parallelDecode = false; // Decode on the worker pool, for the big bulk loads like the reindexing
+		};
+
+		bool queryPatches(SQLite::Database& db, PatchFilter const& filter, std::string const& columns, int skip, int limit, PatchPageToken* page, QueryControl const* control, std::string const& caller, std::function<void(SQLite::Statement&)> rowHandler) {
+			// Without a page token, this uses LIMIT and OFFSET. With a page token, it uses keyset pagination - the query continues right after the sort key of the
+			// last row delivered, so SQLite does not have to walk through all previous rows again and deep pages cost the same as the first one
+			std::vector<SortKeyColumn> keyColumns;
+			std::string selectStatement;
+			if (page) {
+				if (page->orderBy != filter.orderBy) {
+					if (!page->lastKey.empty()) {
+						jassertfalse;
+						SimpleLogger::instance()->postMessage("Program error - page token was created for a different ordering, restarting from the first page");
+					}
+					*page = PatchPageToken();
+					page->orderBy = filter.orderBy;
+				}
+				keyColumns = sortKeyColumns(filter.orderBy);
+				std::string keyExpressions, orderBy;
+				for (size_t i = 0; i < keyColumns.size(); i++) {
+					keyExpressions += fmt::format(", {} AS sort_key{}", keyColumns[i].expression, i);
+					orderBy = prependWithComma(orderBy, keyColumns[i].expression);
+				}
+				selectStatement = "SELECT " + columns + keyExpressions + " FROM patches " + buildJoinClause(filter) + buildWhereClause(filter, true) + buildSeekClause(keyColumns, *page) + " ORDER BY " + orderBy;
+				if (limit != -1) {
+					selectStatement += " LIMIT :LIM ";
+				}
+			}
+			else {
+				selectStatement = "SELECT " + columns + " FROM patches " + buildJoinClause(filter) + buildWhereClause(filter, true) + buildOrderClause(filter);
+				if (limit != -1) {
+					selectStatement += " LIMIT :LIM ";
+					selectStatement += " OFFSET :OFS";
+				}
+			}
+			auto bindParameters = [&](SQLite::Statement& query) {
+				bindWhereClause(query, filter);
+				if (page) {
+					bindSeekClause(query, keyColumns, *page);
+				}
+				if (limit != -1) {
+					query.bind(":LIM", limit);
+					if (!page) {
+						query.bind(":OFS", skip);
+					}
+				}
+			};
+			try {
+#if JUCE_DEBUG
+				flagFullTableScans(db, selectStatement, filter, bindParameters);
+#endif
+				double startTime = Time::getMillisecondCounterHiRes();
+				auto cachedQuery = statementsFor(db).prepare(selectStatement);
+				SQLite::Statement& query = *cachedQuery;
+				bindParameters(query);
+				int rowsRead = 0;
+				std::vector<var> lastKey;
+				try {
+					while (query.executeStep()) {
+						if (control && control->shouldAbort && control->shouldAbort()) {
+							DatabaseInstrumentation::statementDone(query, (uint64)rowsRead);
+							return false;
+						}
+						rowsRead++;
+						if (page) {
+							lastKey.clear();
+							for (size_t i = 0; i < keyColumns.size(); i++) {
+								lastKey.push_back(sortKeyValue(query.getColumn(fmt::format("sort_key{}", i).c_str())));
+							}
+						}
+						rowHandler(query);
+					}
+				}
+				catch (...) {
+					// Reset the counters of the cached statement, else its next execution is charged with them
+					DatabaseInstrumentation::statementDone(query, (uint64)rowsRead);
+					throw;
+				}
+				statementFinished(db, query, caller, selectStatement, [&]() { return fmt::format("{} skip {} limit {}", filterCacheKey(filter), skip, limit); }, startTime, (uint64)rowsRead, bindParameters);
+				if (page) {
+					if (rowsRead > 0) {
+						page->lastKey = lastKey;
+					}
+					page->endReached = limit == -1 || rowsRead < limit;
+				}
+				return true;
+			}
+			catch (SQLite::Exception& ex) {
+				SimpleLogger::instance()->postMessage(fmt::format("DATABASE ERROR in {}: SQL Exception {}", caller, ex.what()));
+			}
+			return false;
+		}
+
+		std::vector<PatchHolder> getPatchesPage(PatchFilter filter, int skip, int limit, PatchPageToken* page, bool useReadConnection, QueryControl const* control = nullptr) {
+			std::vector<PatchHolder> result;
+			// Keyset pages and streamed results bypass the cache, the first depend on the token and the second are never complete in one piece.
+			// Unlimited queries load whole libraries, which are too big to keep around
+			bool byOffset = page == nullptr && !(control && control->chunkLoaded);
+			bool cacheable = byOffset && limit >= 0;
+			std::string key;
+			auto generations = currentGenerations();
+			if (cacheable) {
+				key = filterCacheKey(filter);
+				if (queryCache_.lookupPatches(key, skip, limit, generations, result)) {
+					return result;
+				}
+			}
+			std::vector<std::pair<std::string, PatchHolder>> faultyIndexedPatches;
+			bool success;
+			auto snapshot = byOffset ? snapshotFor(filter) : nullptr;
+			if (snapshot) {
+				// The snapshot picks the page, SQLite only reads the rows on it
+				auto ids = snapshot->ids(filter, categoryCache()->bitfield, skip, limit);
+				success = withReadConnection(useReadConnection, [&](SQLite::Database& db) {
+					return loadPatchesById(db, ids, filter.synths, result, faultyIndexedPatches);
+					});
+			}
+			else {
+				success = getPatches(filter, result, faultyIndexedPatches, skip, limit, page, useReadConnection, control);
+			}
+			if (success) {
+				if (!faultyIndexedPatches.empty()) {
+					SimpleLogger::instance()->postMessage(fmt::format("Found {} patches with inconsistent MD5 - please run the Edit... Reindex Patches command for this synth", faultyIndexedPatches.size()));
+				}
+				if (cacheable) {
+					queryCache_.storePatches(key, skip, limit, dependsOnLists(filter), generations, result);
+				}
+				return result;
+			}
+			else {
+				return {};
+			}
+		}
+
+		bool getPatches(PatchFilter filter, std::vector<PatchHolder>& result, std::vector<std::pair<std::string, PatchHolder>>& needsReindexing, int skip, int limit, PatchPageToken* page = nullptr, bool useReadConnection = false, QueryControl const* control = nullptr) {
+			return withReadConnection(useReadConnection, [&](SQLite::Database& db) {
+				return getPatches(db, filter, result, needsReindexing, skip, limit, page, control);
+				});
+		}
+
+		bool getPatches(SQLite::Database& db, PatchFilter filter, std::vector<PatchHolder>& result, std::vector<std::pair<std::string, PatchHolder>>& needsReindexing, int skip, int limit, PatchPageToken* page, QueryControl const* control) {
+			bool streamed = control && control->chunkLoaded && control->chunkSize > 0;
+			if (!streamed && control && control->parallelDecode) {
+				return getPatchesPipelined(db, filter, result, needsReindexing, skip, limit, page, control);
+			}
+			auto categories = categoryCache();
+			RawPatchRow scratch;
+			bool success = queryPatches(db, filter, "*" + extendedCategoryColumn(*categories), skip, limit, page, control, "getPatches", [&](SQLite::Statement& query) {
+				// Find the synth this patch is for
+				auto synthName = query.getColumn("synth");
+				if (filter.synths.find(synthName) == filter.synths.end()) {
+					SimpleLogger::instance()->postMessage(fmt::format("Program error, query returned patch for synth {} which was not part of the filter", synthName.getString()));
+					return;
+				}
+				auto thisSynth = filter.synths[synthName].lock();
+
+				if (loadPatchFromQueryRow(thisSynth, query, *categories, scratch, result)) {
+					// Check if the MD5 is the correct one (the algorithm might have changed!)
+					std::string md5stored = query.getColumn("md5");
+					if (result.back().md5() != md5stored) {
+						needsReindexing.emplace_back(md5stored, result.back());
+					}
+				}
+				if (streamed && result.size() >= control->chunkSize) {
+					control->chunkLoaded(std::move(result));
+					result.clear();
+				}
+			});
+			if (success && streamed && !result.empty()) {
+				control->chunkLoaded(std::move(result));
+				result.clear();
+			}
+			return success;
+		}
+
+		struct DecodeBatch {
+			std::vector<RawPatchRow> rows; // Recycled from a decoded batch, only the first rowCount are in use
+			size_t rowCount = 0;
+			std::vector<PatchHolder> patches;
+			std::vector<std::pair<std::string, PatchHolder>> needsReindexing;
+		};
+
+		// The rows of the decoded batches, so the row buffers keep their capacity. Shared with the decode jobs, which hand their rows back
+		struct RowFreeList {
+			CriticalSection lock;
+			std::vector<std::vector<RawPatchRow>> freeRows;
+
+			void recycleRows(std::vector<RawPatchRow>&& rows) {
+				ScopedLock scoped(lock);
+				freeRows.push_back(std::move(rows));
+			}
+
+			std::vector<RawPatchRow> takeRows() {
+				ScopedLock scoped(lock);
+				if (freeRows.empty()) {
+					std::vector<RawPatchRow> rows;
+					rows.reserve(kDecodeBatchSize);
+					return rows;
+				}
+				auto rows = std::move(freeRows.back());
+				freeRows.pop_back();
+				return rows;
+			}
+		};
+
+		ThreadPool& workerPool() {
+			ScopedLock lock(decodePoolLock_);
+			if (!decodePool_) {
+				decodePool_ = std::make_unique<ThreadPool>(std::max(1, SystemStats::getNumCpuCores() - 1));
+			}
+			return *decodePool_;
+		}
+
+		bool getPatchesPipelined(SQLite::Database& db, PatchFilter filter, std::vector<PatchHolder>& result, std::vector<std::pair<std::string, PatchHolder>>& needsReindexing, int skip, int limit, PatchPageToken* page, QueryControl const* control) {
+			// For big result sets, creating the patches via the synth dominates the time over stepping the statement. So the calling thread only copies the rows out of 
+			// the statement into batches, and the worker pool turns the batches into PatchHolders and checks their MD5 while the next rows are read.
+			// The batches are collected in order, so the result is the same as the sequential loop
+			auto categories = categoryCache();
+			auto freeList = std::make_shared<RowFreeList>();
+			std::vector<std::shared_ptr<DecodeBatch>> batches;
+			auto current = std::make_shared<DecodeBatch>();
+			current->rows = freeList->takeRows();
+
+			auto decode = [this, categories](DecodeBatch& batch) {
+				for (size_t i = 0; i < batch.rowCount; i++) {
+					auto const& row = batch.rows[i];
+					if (decodePatchRow(row, *categories, batch.patches)) {
+						// Check if the MD5 is the correct one (the algorithm might have changed!)
+						if (batch.patches.back().md5() != row.md5) {
+							batch.needsReindexing.emplace_back(row.md5, batch.patches.back());
+						}
+					}
+				}
+			};
+			// Bound the queue, else a fast reader would copy the whole result set into memory before the decoders catch up.
+			// The jobs use the category snapshot and the synths of this query, so they are waited for also when the query throws. A throwing job is reported after the wait
+			ParallelJobs decoders(workerPool(), kDecodeBatchesInFlight);
+			auto submit = [&]() {
+				batches.push_back(current);
+				decoders.addJob([batch = current, freeList, decode]() {
+					decode(*batch);
+					// The next batch reads into these rows, reusing the buffers of the patch data
+					batch->rowCount = 0;
+					freeList->recycleRows(std::move(batch->rows));
+					});
+				current = std::make_shared<DecodeBatch>();
+				current->rows = freeList->takeRows();
+			};
+
+			bool success = queryPatches(db, filter, "*" + extendedCategoryColumn(*categories), skip, limit, page, control, "getPatches", [&](SQLite::Statement& query) {
+				// Find the synth this patch is for
+				auto synthName = query.getColumn("synth");
+				if (filter.synths.find(synthName) == filter.synths.end()) {
+					SimpleLogger::instance()->postMessage(fmt::format("Program error, query returned patch for synth {} which was not part of the filter", synthName.getString()));
+					return;
+				}
+				if (current->rowCount == current->rows.size()) {
+					current->rows.emplace_back();
+				}
+				readPatchRow(filter.synths[synthName].lock(), query, *categories, current->rows[current->rowCount++]);
+				if (current->rowCount >= kDecodeBatchSize) {
+					submit();
+				}
+			});
+
+			if (success) {
+				if (batches.empty()) {
+					// Everything fit into one batch, not worth a thread switch
+					decode(*current);
+					batches.push_back(current);
+				}
+				else if (current->rowCount > 0) {
+					submit();
+				}
+			}
+			if (!decoders.wait()) {
+				SimpleLogger::instance()->postMessage(fmt::format("DATABASE ERROR in getPatches: Failed to decode patches: {}", decoders.error()));
+				return false;
 			}
-			return false;
-		}
-
-		bool getSinglePatch(std::shared_ptr<Synth> synth, std::string const& md5, std::vector<PatchHolder>& result) {
-			try {
-				SQLite::Statement query(db_, "SELECT * FROM patches WHERE md5 = :MD5 and synth = :SYN");
-				query.bind(":SYN", synth->getName());
-				query.bind(":MD5", md5);
-				if (query.executeStep()) {
-					return loadPatchFromQueryRow(synth, query, result);
-				}
+			if (!success) {
+				return false;
 			}
-			catch (SQLite::Exception& ex) {
-				SimpleLogger::instance()->postMessage(fmt::format("DATABASE ERROR in getSinglePatch: SQL Exception {}", ex.what()));
+			for (auto& batch : batches) {
+				std::move(batch->patches.begin(), batch->patches.end(), std::back_inserter(result));
+				std::move(batch->needsReindexing.begin(), batch->needsReindexing.end(), std::back_inserter(needsReindexing));
 			}
-			return false;
+			return true;
 		}
 
-		bool getPatches(PatchFilter filter, std::vector<PatchHolder>& result, std::vector<std::pair<std::string, PatchHolder>>& needsReindexing, int skip, int limit) {
-			std::string selectStatement = "SELECT * FROM patches " + buildJoinClause(filter) + buildWhereClause(filter, true) + buildOrderClause(filter);
-			if (limit != -1) {
-				selectStatement += " LIMIT :LIM ";
-				selectStatement += " OFFSET :OFS";
-			}
-			try {
-				SQLite::Statement query(db_, selectStatement.c_str());
-
-				bindWhereClause(query, filter);
-				if (limit != -1) {
-					query.bind(":LIM", limit);
-					query.bind(":OFS", skip);
-				}
-				while (query.executeStep()) {
-					// Find the synth this patch is for
-					auto synthName = query.getColumn("synth");
-					if (filter.synths.find(synthName) == filter.synths.end()) {
-						SimpleLogger::instance()->postMessage(fmt::format("Program error, query returned patch for synth {} which was not part of the filter", synthName.getString()));
-						continue;
+		bool getPatchesMetaData(PatchFilter filter, std::vector<PatchMetaData>& result, int skip, int limit, PatchPageToken* page) {
+			// Same query as getPatches, but without the data BLOB, and no patch is created by the synth
+			auto categories = categoryCache();
+			return queryPatches(db_, filter, "patches.synth AS synth, patches.md5 AS md5, name, type, favorite, hidden, sourceID, sourceName, midiBankNo, midiProgramNo, categories, categoryUserDecision"
+				+ extendedCategoryColumn(*categories),
+				skip, limit, page, nullptr, "getPatchesMetaData", [&](SQLite::Statement& query) {
+					PatchMetaData row;
+					row.synthName = query.getColumn("synth").getString();
+					row.md5 = query.getColumn("md5").getString();
+					row.name = query.getColumn("name").getString();
+					row.type = query.getColumn("type").getInt();
+					auto favoriteColumn = query.getColumn("favorite");
+					if (favoriteColumn.isInteger()) {
+						row.favorite = Favorite(favoriteColumn.getInt()).is();
 					}
-					auto thisSynth = filter.synths[synthName].lock();
+					row.hidden = query.getColumn("hidden").getInt() == 1;
+					row.sourceID = query.getColumn("sourceID").getString();
+					row.sourceName = query.getColumn("sourceName").getString();
+					auto bankColumn = query.getColumn("midiBankNo");
+					row.midiBankNo = bankColumn.isNull() ? -1 : bankColumn.getInt();
+					row.midiProgramNo = query.getColumn("midiProgramNo").getInt();
+					categories->bitfield.makeSetOfCategoriesFromBitfield(row.categories, query.getColumn("categories").getInt64());
+					categories->bitfield.makeSetOfCategoriesFromBitfield(row.userDecisions, query.getColumn("categoryUserDecision").getInt64());
+					addExtendedCategories(query, *categories, row.categories, row.userDecisions);
+					result.push_back(row);
+				});
+		}
 
-					if (loadPatchFromQueryRow(thisSynth, query, result)) {
-						// Check if the MD5 is the correct one (the algorithm might have changed!)
-						std::string md5stored = query.getColumn("md5");
-						if (result.back().md5() != md5stored) {
-							needsReindexing.emplace_back(md5stored, result.back());
+		std::vector<PatchHolder> loadPatches(std::vector<PatchMetaData> const& rows, std::map<std::string, std::weak_ptr<Synth>> synths) {
+			// Materialize the full patches for a set of metadata rows, typically the ones currently visible. 
+			// Uses one query per synth and chunk of md5s, and returns the patches in the order of the rows. Rows of synths not given are skipped
+			std::map<std::pair<std::string, std::string>, PatchHolder> loaded;
+			std::map<std::string, std::vector<std::string>> md5sPerSynth;
+			for (auto const& row : rows) {
+				md5sPerSynth[row.synthName].push_back(row.md5);
+			}
+			auto categories = categoryCache();
+			RawPatchRow scratch;
+			for (auto const& synthMd5s : md5sPerSynth) {
+				auto synth = synths.find(synthMd5s.first);
+				if (synth == synths.end()) {
+					continue;
+				}
+				auto thisSynth = synth->second.lock();
+				for (size_t chunkStart = 0; chunkStart < synthMd5s.second.size(); chunkStart += kLookupChunkSize) {
+					size_t chunkEnd = std::min(chunkStart + kLookupChunkSize, synthMd5s.second.size());
+					try {
+						auto cachedQuery = statements_.prepare("SELECT *" + extendedCategoryColumn(*categories) + " FROM patches WHERE synth = ? AND md5 IN (" + placeholderList(chunkEnd - chunkStart) + ")");
+						SQLite::Statement& query = *cachedQuery;
+						int index = 1;
+						query.bind(index++, synthMd5s.first);
+						for (size_t i = chunkStart; i < chunkEnd; i++) {
+							query.bind(index++, synthMd5s.second[i]);
+						}
+						while (query.executeStep()) {
+							std::vector<PatchHolder> patch;
+							if (loadPatchFromQueryRow(thisSynth, query, *categories, scratch, patch)) {
+								loaded.emplace(std::make_pair(synthMd5s.first, query.getColumn("md5").getString()), patch.back());
+							}
 						}
 					}
+					catch (SQLite::Exception& ex) {
+						SimpleLogger::instance()->postMessage(fmt::format("DATABASE ERROR in loadPatches: SQL Exception {}", ex.what()));
+					}
 				}
-				return true;
 			}
-			catch (SQLite::Exception& ex) {
-				SimpleLogger::instance()->postMessage(fmt::format("DATABASE ERROR in getPatches: SQL Exception {}", ex.what()));
+			std::vector<PatchHolder> result;
+			for (auto const& row : rows) {
+				auto found = loaded.find(std::make_pair(row.synthName, row.md5));
+				if (found != loaded.end()) {
+					result.push_back(found->second);
+				}
 			}
-			return false;
+			return result;
+		}
+
+		static std::string placeholderList(size_t count) {
+			// Positional parameters for an IN clause, bind them with 1-based indexes
+			std::string result;
+			for (size_t i = 0; i < count; i++) {
+				result += i == 0 ? "?" : ", ?";
+			}
+			return result;
 		}
 
 		std::map<std::string, PatchHolder> bulkGetPatches(std::vector<PatchHolder> const& patches, ProgressHandler* progress) {
 			// Query the database for exactly those patches, we want to know which ones are already there!
+			// This is done per synth with chunks of md5s in an IN clause, and it already fetches everything the merge logic needs about the existing patch,
+			// so the number of statements depends on the number of chunks, not on the number of patches
 			std::map<std::string, PatchHolder> result;
 
-			int checkedForExistance = 0;
-			for (auto ph : patches) {
-				if (progress && progress->shouldAbort()) return std::map<std::string, PatchHolder>();
-				// First, calculate list of "IDs"
-				// Query the database if this exists. Normally, I would bulk, but as the database is local for now I think we're going to be fine
-				try {
-					std::string md5 = ph.md5();
-					SQLite::Statement query(db_, "SELECT md5, name, midiProgramNo, midiBankNo FROM patches WHERE md5 = :MD5 and synth = :SYN");
-					query.bind(":SYN", ph.synth()->getName());
-					query.bind(":MD5", md5);
-					if (query.executeStep()) {
-						MidiProgramNumber program;
-						MidiBankNumber bank = MidiBankNumber::invalid();
-						loadBankAndProgram(ph.smartSynth(), query, bank, program);
-						PatchHolder existingPatch(ph.smartSynth(), ph.sourceInfo(), nullptr, bank, program);
-						std::string name = query.getColumn("name");
-						existingPatch.setName(name);
-						result.emplace(md5, existingPatch);
+			std::map<std::string, std::map<std::string, PatchHolder const*>> md5sPerSynth;
+			for (auto const& ph : patches) {
+				md5sPerSynth[ph.synth()->getName()].emplace(ph.md5(), &ph);
+			}
+
+			auto categories = categoryCache();
+			size_t checkedForExistance = 0;
+			for (auto const& synthMd5s : md5sPerSynth) {
+				auto chunkStart = synthMd5s.second.begin();
+				while (chunkStart != synthMd5s.second.end()) {
+					if (progress && progress->shouldAbort()) return std::map<std::string, PatchHolder>();
+					auto chunkEnd = chunkStart;
+					size_t chunkSize = 0;
+					while (chunkEnd != synthMd5s.second.end() && chunkSize < kLookupChunkSize) {
+						chunkEnd++;
+						chunkSize++;
 					}
+					try {
+						auto cachedQuery = statements_.prepare("SELECT md5, name, sourceID, midiProgramNo, midiBankNo, favorite, hidden, categories, categoryUserDecision"
+							+ extendedCategoryColumn(*categories) + " FROM patches WHERE synth = ? AND md5 IN (" + placeholderList(chunkSize) + ")");
+						SQLite::Statement& query = *cachedQuery;
+						int index = 1;
+						query.bind(index++, synthMd5s.first);
+						for (auto md5 = chunkStart; md5 != chunkEnd; md5++) {
+							query.bind(index++, md5->first);
+						}
+						while (query.executeStep()) {
+							std::string md5 = query.getColumn("md5");
+							auto requested = synthMd5s.second.find(md5);
+							if (requested == synthMd5s.second.end()) {
+								jassertfalse;
+								continue;
+							}
+							auto ph = requested->second;
+							MidiProgramNumber program;
+							MidiBankNumber bank = MidiBankNumber::invalid();
+							loadBankAndProgram(ph->smartSynth(), query, bank, program);
+							// This is a projection without the patch data, which is not needed for merging
+							PatchHolder existingPatch(ph->smartSynth(), ph->sourceInfo(), nullptr, bank, program);
+							loadMetadataFromQueryRow(query, *categories, existingPatch);
+							result.emplace(md5, existingPatch);
+						}
+					}
+					catch (SQLite::Exception& ex) {
+						SimpleLogger::instance()->postMessage(fmt::format("DATABASE ERROR in bulkGetPatches: SQL Exception {}", ex.what()));
+					}
+					checkedForExistance += chunkSize;
+					if (progress) progress->setProgressPercentage(checkedForExistance / (double)patches.size());
+					chunkStart = chunkEnd;
 				}
-				catch (SQLite::Exception& ex) {
-					SimpleLogger::instance()->postMessage(fmt::format("DATABASE ERROR in bulkGetPatches: SQL Exception {}", ex.what()));
-				}
-				if (progress) progress->setProgressPercentage(checkedForExistance++ / (double)patches.size());
 			}
 			return result;
 		}
@@ -784,11 +1976,13 @@ namespace midikraft {
 				if (updateChoices & UPDATE_FAVORITE) updateClause = prependWithComma(updateClause, "favorite = :FAV");
 
 				try {
-					SQLite::Statement sql(db_, "UPDATE patches SET " + updateClause + " WHERE md5 = :MD5 and synth = :SYN");
+					auto cachedSql = statements_.prepare("UPDATE patches SET " + updateClause + " WHERE md5 = :MD5 and synth = :SYN");
+					SQLite::Statement& sql = *cachedSql;
 					if (updateChoices & UPDATE_CATEGORIES) {
 						calculateMergedCategories(newPatch, existingPatch);
-						sql.bind(":CAT", bitfield.categorySetAsBitfield(newPatch.categories()));
-						sql.bind(":CUD", bitfield.categorySetAsBitfield(newPatch.userDecisionSet()));
+						auto categories = categoryCache();
+						sql.bind(":CAT", categories->bitfield.categorySetAsBitfield(newPatch.categories()));
+						sql.bind(":CUD", categories->bitfield.categorySetAsBitfield(newPatch.userDecisionSet()));
 					}
 					if (updateChoices & UPDATE_NAME) {
 						sql.bind(":NAM", newPatch.name());
@@ -808,6 +2002,10 @@ namespace midikraft {
 						jassert(false);
 						throw new std::runtime_error("FATAL, I don't want to ruin your database");
 					}
+					if (updateChoices & UPDATE_CATEGORIES) {
+						writePatchCategories(existingPatch.synth()->getName(), newPatch.md5(), newPatch.categories(), newPatch.userDecisionSet(), *categoryCache(), true);
+					}
+					patchesChanged();
 				}
 				catch (SQLite::Exception& ex) {
 					SimpleLogger::instance()->postMessage(fmt::format("DATABASE ERROR in updatePatch: SQL Exception {}", ex.what()));
@@ -826,7 +2024,8 @@ namespace midikraft {
 		bool insertImportInfo(std::string const& synthname, std::string const& source_id, std::string const& importName) {
 			// Check if this import already exists 
 			try {
-				SQLite::Statement query(db_, "SELECT count(*) AS numExisting FROM imports WHERE synth = :SYN and id = :SID");
+				auto cachedQuery = statements_.prepare("SELECT count(*) AS numExisting FROM imports WHERE synth = :SYN and id = :SID");
+				SQLite::Statement& query = *cachedQuery;
 				query.bind(":SYN", synthname);
 				query.bind(":SID", source_id);
 				if (query.executeStep()) {
@@ -837,7 +2036,8 @@ namespace midikraft {
 				}
 
 				// Record this import in the import table for later filtering! The name of the import might differ for different patches (bulk import), use the first patch to calculate it
-				SQLite::Statement sql(db_, "INSERT INTO imports (synth, name, id, date) VALUES (:SYN, :NAM, :SID, datetime('now'))");
+				auto cachedSql = statements_.prepare("INSERT INTO imports (synth, name, id, date) VALUES (:SYN, :NAM, :SID, datetime('now'))");
+				SQLite::Statement& sql = *cachedSql;
 				sql.bind(":SYN", synthname);
 				sql.bind(":NAM", importName);
 				sql.bind(":SID", source_id);
@@ -877,20 +2077,8 @@ namespace midikraft {
 						SimpleLogger::instance()->postMessage(fmt::format("Renaming {} with better name {}", knownPatches[md5_key].name(), patch.name()));
 					}
 
-					// Update the database with the new info. If more than the name should be updated, we first need to load the full existing patch (the bulkGetPatches only is a projection with the name loaded only)
-					if (onlyUpdateThis != UPDATE_NAME) {
-						std::vector<PatchHolder> result;
-						if (getSinglePatch(patch.smartSynth(), md5_key, result)) {
-							updatePatch(patch, result.back(), onlyUpdateThis);
-						}
-						else {
-							jassertfalse;
-						}
-					}
-					else {
-						// We don't need to get back to the database if we only update the name
-						updatePatch(patch, knownPatches[md5_key], UPDATE_NAME);
-					}
+					// Update the database with the new info. The projection loaded by bulkGetPatches has all fields needed to merge categories and favorites
+					updatePatch(patch, knownPatches[md5_key], onlyUpdateThis);
 				}
 				else {
 					// This is a new patch - it needs to be uploaded into the database!
@@ -928,10 +2116,12 @@ namespace midikraft {
 				}
 			}
 
-			//TODO can be replaced by repaired bulkPut
 			std::map<String, PatchHolder> md5Inserted;
 			std::map<Synth*, int> synthsWithUploadedItems;
 			int sumOfAll = 0;
+			auto cachedInsertSql = statements_.prepare(kInsertPatchSql);
+			SQLite::Statement& insertSql = *cachedInsertSql;
+			auto categories = categoryCache();
 			for (const auto& newPatch : outNewPatches) {
 				if (progress && progress->shouldAbort()) {
 					return (size_t)sumOfAll;
@@ -951,7 +2141,7 @@ namespace midikraft {
 				}
 				else {
 					if (newPatch.sourceId().empty()) {
-						putPatch(newPatch, mapMD5_to_idOfImport[patchMD5]);
+						insertPatch(insertSql, newPatch, mapMD5_to_idOfImport[patchMD5], *categories);
 						if (synthsWithUploadedItems.find(newPatch.synth()) == synthsWithUploadedItems.end()) {
 							// First time this synth sees an upload
 							synthsWithUploadedItems[newPatch.synth()] = 0;
@@ -959,7 +2149,7 @@ namespace midikraft {
 						synthsWithUploadedItems[newPatch.synth()] += 1;
 					}
 					else {
-						putPatch(newPatch, newPatch.sourceId());
+						insertPatch(insertSql, newPatch, newPatch.sourceId(), *categories);
 					}
 					md5Inserted[patchMD5] = newPatch;
 					sumOfAll++;
@@ -972,34 +2162,51 @@ namespace midikraft {
 			}
 
 			if (transaction) transaction->commit();
+			// Without our own transaction the caller commits and needs to call patchesChanged() again afterwards
+			patchesChanged();
 
 			return sumOfAll;
 		}
 
 		int deletePatches(PatchFilter filter) {
 			try {
-				// Build a delete query. If we delete a whole list's content, we cannot use a join clause like in the select, 
-				// but need to transform into a where exists clause :-(
-				std::string deleteStatement;
-				if (filter.listID.empty()) {
-					deleteStatement = "DELETE FROM patches " + buildWhereClause(filter, false);
-				}
-				else {
-					// https://stackoverflow.com/questions/24511153/how-delete-table-inner-join-with-other-table-in-sqlite
-					// This wouldn't work for buildWhereClause during delete
-					deleteStatement = "DELETE FROM patches WHERE ROWID IN (SELECT patches.ROWID FROM patches "
-						+ buildJoinClause(filter) + buildWhereClause(filter, false) + ")";
-				}
-				SQLite::Statement query(db_, deleteStatement.c_str());
-				bindWhereClause(query, filter);
-
-				// Execute
-				int rowsDeleted = query.exec();
+				// Savepoints instead of a transaction, as we might be called within one
+				db_.exec("SAVEPOINT delete_patches");
+				try {
+					// Collect the patches matching the filter first. This frees us from the join clause in the delete itself, and tells us 
+					// exactly which list entries to remove instead of sweeping all lists for orphans afterwards
+					db_.exec("CREATE TEMP TABLE IF NOT EXISTS patches_to_delete (synth TEXT, md5 TEXT)");
+					db_.exec("DELETE FROM patches_to_delete");
+					double startTime = Time::getMillisecondCounterHiRes();
+					std::string collectSql = "INSERT INTO patches_to_delete SELECT patches.synth, patches.md5 FROM patches " + buildJoinClause(filter) + buildWhereClause(filter, false);
+					auto cachedCollect = statements_.prepare(collectSql);
+					SQLite::Statement& collect = *cachedCollect;
+					bindWhereClause(collect, filter);
+					int collected;
+					try {
+						collected = collect.exec();
+					}
+					catch (...) {
+						// Reset the counters of the cached statement, else its next execution is charged with them
+						DatabaseInstrumentation::statementDone(collect, 0);
+						throw;
+					}
+					statementFinished(db_, collect, "deletePatches", collectSql, [&]() { return filterCacheKey(filter); }, startTime, (uint64)collected, [&](SQLite::Statement& explain) { bindWhereClause(explain, filter); });
 
-				// Make sure there are no orphans left in any patch list
-				removeAllOrphansFromPatchLists();
+					db_.exec("DELETE FROM patch_in_list WHERE (synth, md5) IN (SELECT synth, md5 FROM patches_to_delete)");
+					// Execute
+					int rowsDeleted = db_.exec("DELETE FROM patches WHERE (synth, md5) IN (SELECT synth, md5 FROM patches_to_delete)");
+					db_.exec("DELETE FROM patches_to_delete");
+					db_.exec("RELEASE delete_patches");
+					patchesChanged();
 
-				return rowsDeleted;
+					return rowsDeleted;
+				}
+				catch (SQLite::Exception&) {
+					db_.exec("ROLLBACK TO delete_patches");
+					db_.exec("RELEASE delete_patches");
+					throw;
+				}
 			}
 			catch (SQLite::Exception& ex) {
 				SimpleLogger::instance()->postMessage(fmt::format("DATABASE ERROR in deletePatches via filter: SQL Exception {}", ex.what()));
@@ -1009,21 +2216,38 @@ namespace midikraft {
 
 		int deletePatches(std::string const& synth, std::vector<std::string> const& md5s) {
 			try {
-				int rowsDeleted = 0;
-				for (auto md5 : md5s) {
-					// Build a delete query
-					std::string deleteStatement = "DELETE FROM patches WHERE md5 = :MD5 AND synth = :SYN";
-					SQLite::Statement query(db_, deleteStatement.c_str());
-					query.bind(":SYN", synth);
-					query.bind(":MD5", md5);
-					// Execute
-					rowsDeleted += query.exec();
-				}
-
-				// Make sure there are no orphans left in any patch list
-				removeAllOrphansFromPatchLists();
+				// All or nothing, in chunks of md5s per statement. Savepoints instead of a transaction, as reindexPatches calls us within one
+				db_.exec("SAVEPOINT delete_patches");
+				try {
+					int rowsDeleted = 0;
+					for (size_t chunkStart = 0; chunkStart < md5s.size(); chunkStart += kLookupChunkSize) {
+						size_t chunkEnd = std::min(chunkStart + kLookupChunkSize, md5s.size());
+						auto bindChunk = [&](SQLite::Statement& statement) {
+							int index = 1;
+							statement.bind(index++, synth);
+							for (size_t i = chunkStart; i < chunkEnd; i++) {
+								statement.bind(index++, md5s[i]);
+							}
+						};
+						// Make sure there are no orphans left in any patch list, touching only the entries of the deleted patches
+						auto cachedRemoveFromLists = statements_.prepare("DELETE FROM patch_in_list WHERE synth = ? AND md5 IN (" + placeholderList(chunkEnd - chunkStart) + ")");
+						bindChunk(*cachedRemoveFromLists);
+						cachedRemoveFromLists->exec();
+
+						auto cachedQuery = statements_.prepare("DELETE FROM patches WHERE synth = ? AND md5 IN (" + placeholderList(chunkEnd - chunkStart) + ")");
+						bindChunk(*cachedQuery);
+						rowsDeleted += cachedQuery->exec();
+					}
+					db_.exec("RELEASE delete_patches");
+					patchesChanged();
 
-				return rowsDeleted;
+					return rowsDeleted;
+				}
+				catch (SQLite::Exception&) {
+					db_.exec("ROLLBACK TO delete_patches");
+					db_.exec("RELEASE delete_patches");
+					throw;
+				}
 			}
 			catch (SQLite::Exception& ex) {
 				SimpleLogger::instance()->postMessage(fmt::format("DATABASE ERROR in deletePatches via md5s: SQL Exception {}", ex.what()));
@@ -1031,30 +2255,62 @@ namespace midikraft {
 			return 0;
 		}
 
-		int reindexPatches(PatchFilter filter) {
+		int reindexPatches(PatchFilter filter, ProgressHandler* progress, PatchPageToken* resumeFrom) {
 			// Give up if more than one synth is selected
 			if (filter.synths.size() > 1) {
 				SimpleLogger::instance()->postMessage("Aborting reindexing - please select only one synth at a time in the advanced filter dialog!");
 				return -1;
 			}
-
-			// Retrieve the patches to reindex
-			std::vector<PatchHolder> result;
-			std::vector<std::pair<std::string, PatchHolder>> toBeReindexed;
-			if (getPatches(filter, result, toBeReindexed, 0, -1)) {
+			auto synth = filter.synths.empty() ? nullptr : filter.synths.begin()->second.lock();
+			if (!synth) {
+				SimpleLogger::instance()->postMessage("Aborting reindexing - no synth selected in the filter");
+				return -1;
+			}
+			auto synthName = synth->getName();
+
+			// Walk the patches in rowid order with keyset pagination, so only one chunk is in RAM at a time. Each chunk is deleted and reinserted in its own transaction,
+			// which keeps the all or nothing guarantee per chunk and never locks the database for long. The page token is only advanced after a chunk is committed,
+			// so it always points behind the last completed chunk and can be used to continue an interrupted run. Running again without a token is fine as well,
+			// patches already reindexed are simply not touched again. Reinserted patches get a new rowid and are visited again at the end, but have their correct MD5 then
+			filter.orderBy = PatchOrdering::No_ordering;
+			PatchPageToken localPage;
+			PatchPageToken& page = resumeFrom ? *resumeFrom : localPage;
+			page.orderBy = PatchOrdering::No_ordering;
+			int total = getPatchesCount(filter);
+
+			QueryControl control;
+			control.shouldAbort = [progress]() { return progress && progress->shouldAbort(); };
+			control.parallelDecode = true;
+
+			size_t visited = 0;
+			size_t reindexed = 0;
+			while (!page.endReached) {
+				if (control.shouldAbort()) {
+					break;
+				}
+				std::vector<PatchHolder> result;
+				std::vector<std::pair<std::string, PatchHolder>> toBeReindexed;
+				PatchPageToken next = page;
+				if (!getPatches(filter, result, toBeReindexed, 0, (int)kBulkChunkSize, &next, false, &control)) {
+					if (control.shouldAbort()) {
+						break;
+					}
+					SimpleLogger::instance()->postMessage("Aborting reindexing - database error retrieving the filtered patches");
+					return -1;
+				}
 				if (!toBeReindexed.empty()) {
 					std::vector<std::string> toBeDeleted;
 					std::vector<PatchHolder> toBeReinserted;
-					for (auto d : toBeReindexed) {
+					for (auto const& d : toBeReindexed) {
 						toBeDeleted.push_back(d.first);
 						toBeReinserted.push_back(d.second);
 					}
 
-					// This is a complex database operation, use a transaction to make sure we get all or nothing
+					// This is a complex database operation, use a transaction to make sure we get all or nothing of this chunk
 					SQLite::Transaction transaction(db_);
 
-					// We got everything into the RAM - do we dare do delete them from the database now?
-					int deleted = deletePatches(filter.synths.begin()->second.lock()->getName(), toBeDeleted);
+					// We got the chunk into the RAM - do we dare do delete them from the database now?
+					int deleted = deletePatches(synthName, toBeDeleted);
 					if (deleted != (int)toBeReindexed.size()) {
 						SimpleLogger::instance()->postMessage("Aborting reindexing - count of deleted patches does not match count of retrieved patches. Program Error.");
 						return -1;
@@ -1064,19 +2320,22 @@ namespace midikraft {
 					std::vector<PatchHolder> remainingPatches;
 					mergePatchesIntoDatabase(toBeReinserted, remainingPatches, nullptr, UPDATE_ALL, false);
 					transaction.commit();
-
-					return getPatchesCount(filter);
-				}
-				else {
-					SimpleLogger::instance()->postMessage("None of the selected patches needed reindexing skipping!");
-					return getPatchesCount(filter);
+					patchesChanged();
+					reindexed += toBeReindexed.size();
 				}
+				page = next;
+				visited += result.size();
+				if (progress && total > 0) progress->setProgressPercentage(std::min(1.0, visited / (double)total));
 			}
-			else {
-				SimpleLogger::instance()->postMessage("Aborting reindexing - database error retrieving the filtered patches");
+
+			if (!page.endReached) {
+				SimpleLogger::instance()->postMessage(fmt::format("Reindexing aborted after {} reindexed patches, run it again to continue", reindexed));
 				return -1;
 			}
-
+			if (reindexed == 0) {
+				SimpleLogger::instance()->postMessage("None of the selected patches needed reindexing skipping!");
+			}
+			return getPatchesCount(filter);
 		}
 
 		std::string databaseFileName() const
@@ -1087,19 +2346,20 @@ namespace midikraft {
 		std::shared_ptr<AutomaticCategory> getCategorizer() {
 			ScopedLock lock(categoryLock_);
 			// Force reload of the categories from the database table
-			categoryDefinitions_ = getCategories();
-			int bitindex = bitfield.maxBitIndex();
+			reloadCategories();
+			auto categories = categoryCache();
+			int bitindex = categories->bitfield.maxBitIndex();
 
 			// The Categorizer currently is constructed from two sources - the list of categories in the database including the bit index
 			// The auto-detection rules are stored in the jsonc file.
 			// This needs to be merged.
-			auto categorizer = std::make_shared<AutomaticCategory>(categoryDefinitions_);
+			auto categorizer = std::make_shared<AutomaticCategory>(categories->categories);
 
 			// First pass - check that all categories referenced in the auto category file are stored in the database, else they will have no bit index!
 			SQLite::Transaction transaction(db_);
 			for (auto rule : categorizer->loadedRules()) {
 				auto exists = false;
-				for (auto cat : categoryDefinitions_) {
+				for (auto cat : categories->categories) {
 					if (cat.category() == rule.category().category()) {
 						exists = true;
 						break;
@@ -1107,7 +2367,7 @@ namespace midikraft {
 				}
 				if (!exists) {
 					// Need to create a new entry in the database
-					if (bitindex < 63) {
+					if (bitindex < CategoryBitfield::kBitfieldSize - 1 || hasCategoryIndex_) {
 						bitindex++;
 						SQLite::Statement sql(db_, "INSERT INTO categories VALUES (:BIT, :NAM, :COL, 1)");
 						sql.bind(":BIT", bitindex);
@@ -1125,10 +2385,11 @@ namespace midikraft {
 			transaction.commit();
 
 			// Refresh from database
-			categoryDefinitions_ = getCategories();
+			reloadCategories();
+			categories = categoryCache();
 
 			// Now we need to merge the database persisted categories with the ones defined in the automatic categories from the json string
-			for (auto cat : categoryDefinitions_) {
+			for (auto cat : categories->categories) {
 				bool exists = false;
 				for (auto rule : categorizer->loadedRules()) {
 					if (cat.category() == rule.category().category()) {
@@ -1150,7 +2411,8 @@ namespace midikraft {
 		std::vector<ListInfo> allUserBanks(std::shared_ptr<Synth> synth)
 		{
 			try {
-				SQLite::Statement query(db_, "SELECT * FROM lists WHERE synth = :SYN");
+				auto cachedQuery = statements_.prepare("SELECT * FROM lists WHERE synth = :SYN");
+				SQLite::Statement& query = *cachedQuery;
 				query.bind(":SYN", synth->getName());
 				std::vector<ListInfo> result;
 				while (query.executeStep()) {
@@ -1171,7 +2433,8 @@ namespace midikraft {
 		std::vector<ListInfo> allPatchLists()
 		{
 			try {
-				SQLite::Statement query(db_, "SELECT * FROM lists WHERE synth is null");
+				auto cachedQuery = statements_.prepare("SELECT * FROM lists WHERE synth is null");
+				SQLite::Statement& query = *cachedQuery;
 				std::vector<ListInfo> result;
 				while (query.executeStep()) {
 					result.push_back({ query.getColumn("id").getText(), query.getColumn("name").getText() });
@@ -1186,7 +2449,8 @@ namespace midikraft {
 		}
 
 		bool doesListExist(std::string listId) {
-			SQLite::Statement query(db_, "SELECT count(*) as num_lists FROM lists WHERE id = :ID");
+			auto cachedQuery = statements_.prepare("SELECT count(*) as num_lists FROM lists WHERE id = :ID");
+			SQLite::Statement& query = *cachedQuery;
 			query.bind(":ID", listId);
 			if (query.executeStep()) {
 				auto result = query.getColumn("num_lists");
@@ -1198,7 +2462,8 @@ namespace midikraft {
 		std::shared_ptr<midikraft::PatchList> getPatchList(ListInfo info, std::map<std::string, std::weak_ptr<Synth>> synths)
 		{
 			// First load the list
-			SQLite::Statement queryList(db_, "SELECT * FROM lists WHERE id = :ID");
+			auto cachedQueryList = statements_.prepare("SELECT * FROM lists WHERE id = :ID");
+			SQLite::Statement& queryList = *cachedQueryList;
 			queryList.bind(":ID", info.id);
 			std::shared_ptr<midikraft::PatchList> list;
 			if (queryList.executeStep()) {
@@ -1236,92 +2501,283 @@ namespace midikraft {
 				}
 			}
 
-			// Now load the patches in this list
-			SQLite::Statement query(db_, "SELECT * from patch_in_list where id=:ID order by order_num");
+			// Now load the patches in this list, in one pass over the list entries joined with their patches
+			auto categories = categoryCache();
+			auto cachedQuery = statements_.prepare("SELECT patches.*" + extendedCategoryColumn(*categories) + " FROM patch_in_list"
+				" JOIN patches ON patches.synth = patch_in_list.synth AND patches.md5 = patch_in_list.md5 WHERE patch_in_list.id = :ID ORDER BY patch_in_list.order_num");
+			SQLite::Statement& query = *cachedQuery;
 			query.bind(":ID", info.id.c_str());
-			std::vector<std::pair<std::string, std::string>> md5s;
-			while (query.executeStep()) {
-				md5s.push_back({ query.getColumn("synth").getText(), query.getColumn("md5").getText() });
-			}
 			std::vector<PatchHolder> result;
-			for (auto const& md5 : md5s) {
-				if (synths.find(md5.first) != synths.end()) {
-					getSinglePatch(synths[md5.first].lock(), md5.second, result);
+			RawPatchRow scratch;
+			std::string lastSynthName;
+			std::shared_ptr<Synth> lastSynth;
+			while (query.executeStep()) {
+				std::string synthName = query.getColumn("synth").getString();
+				if (synthName != lastSynthName || !lastSynth) {
+					// Lists are mostly of one synth, so this lookup is rarely needed
+					auto synth = synths.find(synthName);
+					lastSynthName = synthName;
+					lastSynth = synth != synths.end() ? synth->second.lock() : nullptr;
+				}
+				if (lastSynth) {
+					loadPatchFromQueryRow(lastSynth, query, *categories, scratch, result);
 				}
 			}
 			list->setPatches(result);
 			return list;
 		}
 
-		void addPatchToListInternal(std::string const& listId, std::string const& synthName, std::string const& md5, int insertIndex) {
-			SQLite::Statement insert(db_, "INSERT INTO patch_in_list (id, synth, md5, order_num) VALUES (:ID, :SYN, :MD5, :ONO)");
+		void addPatchToListInternal(std::string const& listId, std::string const& synthName, std::string const& md5, int64 orderKey) {
+			auto cachedInsert = statements_.prepare("INSERT INTO patch_in_list (id, synth, md5, order_num) VALUES (:ID, :SYN, :MD5, :ONO)");
+			SQLite::Statement& insert = *cachedInsert;
 			insert.bind(":ID", listId);
 			insert.bind(":SYN", synthName);
 			insert.bind(":MD5", md5);
-			insert.bind(":ONO", insertIndex);
+			insert.bind(":ONO", orderKey);
 			insert.exec();
 		}
 
+		// List positions as seen by the UI are the ranks in Order_by_Place_in_List order, the order_num values are sparse keys with gaps between them.
+		// Entries are found through the patch they hold and their neighbours with a keyset on (order_num, rowid), so the cost of an edit depends on how far
+		// a patch is moved, not on how deep in the list it is. Only one row is ever written per insert or move
+		struct ListEntry {
+			int64 rowid;
+			int64 orderKey;
+			std::string synth;
+			std::string md5;
+		};
+
+		static ListEntry readListEntry(SQLite::Statement& query) {
+			return { query.getColumn(0).getInt64(), query.getColumn(1).getInt64(), query.getColumn(2).getString(), query.getColumn(3).getString() };
+		}
+
+		int listPositionOf(std::string const& listId, ListEntry const& entry) {
+			auto cachedQuery = statements_.prepare("SELECT count(*) FROM patch_in_list WHERE id = :ID AND (order_num, rowid) < (:ONO, :RID)");
+			SQLite::Statement& query = *cachedQuery;
+			query.bind(":ID", listId);
+			query.bind(":ONO", entry.orderKey);
+			query.bind(":RID", entry.rowid);
+			return query.executeStep() ? query.getColumn(0).getInt() : -1;
+		}
+
+		bool listEntryOf(std::string const& listId, std::string const& synth, std::string const& md5, int position, ListEntry& outEntry) {
+			// The entry holding this patch, via the patch_in_list_patch index. Only a patch that is in the list several times needs its position counted
+			auto cachedQuery = statements_.prepare("SELECT rowid, order_num, synth, md5 FROM patch_in_list WHERE synth = :SYN AND md5 = :MD5 AND id = :ID ORDER BY order_num, rowid");
+			SQLite::Statement& query = *cachedQuery;
+			query.bind(":SYN", synth);
+			query.bind(":MD5", md5);
+			query.bind(":ID", listId);
+			std::vector<ListEntry> candidates;
+			while (query.executeStep()) {
+				candidates.push_back(readListEntry(query));
+			}
+			query.reset();
+			if (candidates.size() == 1) {
+				outEntry = candidates.front();
+				return true;
+			}
+			for (auto const& candidate : candidates) {
+				if (listPositionOf(listId, candidate) == position) {
+					outEntry = candidate;
+					return true;
+				}
+			}
+			return false;
+		}
+
+		bool listEntryNear(std::string const& listId, ListEntry const& from, int steps, ListEntry& outEntry) {
+			// The entry steps positions behind (positive) or in front of (negative) from
+			if (steps == 0) {
+				outEntry = from;
+				return true;
+			}
+			auto cachedQuery = statements_.prepare(steps > 0
+				? "SELECT rowid, order_num, synth, md5 FROM patch_in_list WHERE id = :ID AND (order_num, rowid) > (:ONO, :RID) ORDER BY order_num, rowid LIMIT 1 OFFSET :SKP"
+				: "SELECT rowid, order_num, synth, md5 FROM patch_in_list WHERE id = :ID AND (order_num, rowid) < (:ONO, :RID) ORDER BY order_num DESC, rowid DESC LIMIT 1 OFFSET :SKP");
+			SQLite::Statement& query = *cachedQuery;
+			query.bind(":ID", listId);
+			query.bind(":ONO", from.orderKey);
+			query.bind(":RID", from.rowid);
+			query.bind(":SKP", std::abs(steps) - 1);
+			if (query.executeStep()) {
+				outEntry = readListEntry(query);
+				return true;
+			}
+			return false;
+		}
+
+		bool listEntryAt(std::string const& listId, int position, ListEntry& outEntry) {
+			// Without a patch to start from, count the list and walk in from the nearer end. Appending should not get here, see orderKeyForGap
+			if (position < 0) return false;
+			auto cachedCount = statements_.prepare("SELECT count(*) FROM patch_in_list WHERE id = :ID");
+			SQLite::Statement& count = *cachedCount;
+			count.bind(":ID", listId);
+			int size = count.executeStep() ? count.getColumn(0).getInt() : 0;
+			count.reset();
+			if (position >= size) {
+				return false;
+			}
+			bool fromEnd = position >= size / 2;
+			auto cachedQuery = statements_.prepare(fromEnd
+				? "SELECT rowid, order_num, synth, md5 FROM patch_in_list WHERE id = :ID ORDER BY order_num DESC, rowid DESC LIMIT 1 OFFSET :SKP"
+				: "SELECT rowid, order_num, synth, md5 FROM patch_in_list WHERE id = :ID ORDER BY order_num, rowid LIMIT 1 OFFSET :SKP");
+			SQLite::Statement& query = *cachedQuery;
+			query.bind(":ID", listId);
+			query.bind(":SKP", fromEnd ? size - 1 - position : position);
+			if (query.executeStep()) {
+				outEntry = readListEntry(query);
+				return true;
+			}
+			return false;
+		}
+
+		bool reloadListEntry(ListEntry& entry) {
+			auto cachedQuery = statements_.prepare("SELECT rowid, order_num, synth, md5 FROM patch_in_list WHERE rowid = :RID");
+			SQLite::Statement& query = *cachedQuery;
+			query.bind(":RID", entry.rowid);
+			if (query.executeStep()) {
+				entry = readListEntry(query);
+				return true;
+			}
+			return false;
+		}
+
+		int64 orderKeyBetween(std::string const& listId, std::optional<ListEntry> before, std::optional<ListEntry> after) {
+			// Key for a new entry between the two neighbours, either of them missing at the start or the end of the list. Call within a transaction
+			for (int attempt = 0; attempt < 2; attempt++) {
+				if (!after) {
+					auto cachedQuery = statements_.prepare("SELECT max(order_num) FROM patch_in_list WHERE id = :ID");
+					SQLite::Statement& query = *cachedQuery;
+					query.bind(":ID", listId);
+					if (query.executeStep() && !query.getColumn(0).isNull()) {
+						return query.getColumn(0).getInt64() + kListOrderGap;
+					}
+					return 0;
+				}
+				if (!before) {
+					return after->orderKey - kListOrderGap;
+				}
+				if (after->orderKey - before->orderKey >= 2) {
+					return before->orderKey + (after->orderKey - before->orderKey) / 2;
+				}
+				// No gap left here, spread the whole list again. The neighbours stay the same rows, only their keys change
+				compactList(listId);
+				if (!reloadListEntry(*before) || !reloadListEntry(*after)) {
+					break;
+				}
+			}
+			jassertfalse;
+			throw SQLite::Exception("Program error - no gap in list order after compaction");
+		}
+
+		int64 orderKeyForGap(std::string const& listId, int position) {
+			// Key for a new entry in front of the entry at position, or at the end of the list if there is none. Call within a transaction.
+			// A negative position appends, which is the common case and only needs the max(order_num) of the list
+			ListEntry after;
+			if (position < 0 || !listEntryAt(listId, position, after)) {
+				return orderKeyBetween(listId, std::nullopt, std::nullopt);
+			}
+			ListEntry before;
+			return orderKeyBetween(listId, listEntryNear(listId, after, -1, before) ? std::optional<ListEntry>(before) : std::nullopt, after);
+		}
+
+		void compactList(std::string const& list_id) {
+			// Call this within a transaction! Only needed when the gap between two neighbours has been used up
+			renumberLists(&list_id);
+		}
+
+		void renumberLists(std::string const* list_id) {
+			// Sets the order_num of the entries of one list, or of all lists if null, to their position times the gap.
+			// The positions must be known before the first row is changed, a correlated subquery in the UPDATE would see the half updated table
+			auto run = [this, list_id](std::string const& sql, bool selectsList) {
+				auto cachedStatement = statements_.prepare(sql);
+				SQLite::Statement& statement = *cachedStatement;
+				if (list_id && selectsList) {
+					statement.bind(":ID", *list_id);
+				}
+				statement.exec();
+			};
+			std::string where = list_id ? " WHERE id = :ID" : "";
+			if (sqlite3_libversion_number() >= 3033000) {
+				// UPDATE FROM materializes the positions in the same statement
+				run(fmt::format("UPDATE patch_in_list SET order_num = po.position * {} FROM "
+					"(SELECT rowid AS rid, ROW_NUMBER() OVER (PARTITION BY id ORDER BY order_num, rowid) - 1 AS position FROM patch_in_list{}) AS po WHERE po.rid = patch_in_list.rowid", kListOrderGap, where), true);
+			}
+			else {
+				// SQLite before 3.33 has no UPDATE FROM, so the positions go through a temp table. Counting the predecessors needs no window functions either
+				db_.exec("CREATE TEMP TABLE IF NOT EXISTS list_positions (rid INTEGER PRIMARY KEY, position INTEGER NOT NULL)");
+				db_.exec("DELETE FROM temp.list_positions");
+				run("INSERT INTO temp.list_positions (rid, position) SELECT rowid, (SELECT count(*) FROM patch_in_list AS earlier WHERE earlier.id = patch_in_list.id"
+					" AND (earlier.order_num < patch_in_list.order_num OR (earlier.order_num = patch_in_list.order_num AND earlier.rowid < patch_in_list.rowid))) FROM patch_in_list" + where, true);
+				run(fmt::format("UPDATE patch_in_list SET order_num = (SELECT position FROM temp.list_positions WHERE rid = patch_in_list.rowid) * {}"
+					" WHERE rowid IN (SELECT rid FROM temp.list_positions)", kListOrderGap), false);
+				db_.exec("DELETE FROM temp.list_positions");
+			}
+		}
+
 		void addPatchToList(ListInfo info, PatchHolder const& patch, int insertIndex) {
 			try {
 				SQLite::Transaction transaction(db_);
-				// First make room by moving existing items up
-				SQLite::Statement update(db_, "UPDATE patch_in_list SET order_num = order_num + 1 WHERE id = :ID AND order_num >= :ONO");
-				update.bind(":ID", info.id);
-				update.bind(":ONO", insertIndex);
-				update.exec();
-				addPatchToListInternal(info.id, patch.synth()->getName(), patch.md5(), insertIndex);
+				addPatchToListInternal(info.id, patch.synth()->getName(), patch.md5(), orderKeyForGap(info.id, insertIndex));
 				transaction.commit();
+				listsChanged();
 			}
 			catch (SQLite::Exception& ex) {
 				SimpleLogger::instance()->postMessage(fmt::format("DATABASE ERROR in addPatchToList: SQL Exception {}", ex.what()));
 			}
 		}
 
-		void renumList(std::string const& list_id) {
-			// Call this within a transaction!
-			SQLite::Statement renum(db_, "WITH po AS (SELECT*, ROW_NUMBER() OVER(order by order_num) - 1 AS new_order FROM patch_in_list WHERE id = :ID) "
-				"UPDATE patch_in_list AS pl SET order_num = (SELECT new_order FROM po WHERE pl.synth = po.synth AND pl.md5 = po.md5 AND pl.order_num = po.order_num) where id = :ID");
-			renum.bind(":ID", list_id);
-			renum.exec();
-		}
-
 		void movePatchInList(ListInfo info, PatchHolder const& patch, int previousIndex, int newIndex) {
+			// newIndex is the position the patch is dropped in front of, counted while it is still at previousIndex
 			try {
 				SQLite::Transaction transaction(db_);
-				// First make room by moving existing items up
-				SQLite::Statement update(db_, "UPDATE patch_in_list SET order_num = order_num + 1 WHERE id = :ID AND order_num >= :ONO");
-				update.bind(":ID", info.id);
-				update.bind(":ONO", newIndex);
+				ListEntry moved;
+				if (!listEntryOf(info.id, patch.smartSynth()->getName(), patch.md5(), previousIndex, moved)) {
+					SimpleLogger::instance()->postMessage(fmt::format("Can't move patch in list {}, it is not at position {}", info.name, previousIndex));
+					return;
+				}
+				if (newIndex == previousIndex || newIndex == previousIndex + 1) {
+					// Dropped right in front of or behind itself
+					return;
+				}
+				auto cachedUpdate = statements_.prepare("UPDATE patch_in_list SET order_num = :ONO WHERE rowid = :RID");
+				SQLite::Statement& update = *cachedUpdate;
+				// Walk from the moved entry to the drop position, the entries in between are all that is read
+				int steps = newIndex - previousIndex;
+				std::optional<ListEntry> before, after;
+				ListEntry neighbour;
+				if (listEntryNear(info.id, moved, steps, neighbour)) {
+					after = neighbour;
+				}
+				if (steps > 0 ? listEntryNear(info.id, moved, steps - 1, neighbour) : (after && listEntryNear(info.id, *after, -1, neighbour))) {
+					before = neighbour;
+				}
+				auto newKey = orderKeyBetween(info.id, before, after);
+				update.bind(":ONO", newKey);
+				update.bind(":RID", moved.rowid);
 				update.exec();
-				// Now update the existing element at the previous index at put it at the new Index
-				SQLite::Statement update2(db_, "UPDATE patch_in_list SET order_num = :ONO WHERE id = :ID AND synth = :SYN AND md5 = :MD5 AND order_num = :INC");
-				update2.bind(":ID", info.id);
-				update2.bind(":SYN", patch.smartSynth()->getName());
-				update2.bind(":MD5", patch.md5());
-				update2.bind(":INC", newIndex > previousIndex ? previousIndex : previousIndex + 1);
-				update2.bind(":ONO", newIndex);
-				update2.exec();
-				// Then we may have created a gap in the list, so just renum the whole list
-				renumList(info.id);
 				transaction.commit();
+				listsChanged();
 			}
 			catch (SQLite::Exception& ex) {
-				SimpleLogger::instance()->postMessage(fmt::format("DATABASE ERROR in addPatchToList: SQL Exception {}", ex.what()));
+				SimpleLogger::instance()->postMessage(fmt::format("DATABASE ERROR in movePatchInList: SQL Exception {}", ex.what()));
 			}
 		}
 
 		void removePatchFromList(std::string const& list_id, std::string const& synth_name, std::string const& md5, int order_num) {
+			// order_num is the position of the entry in the list
 			try {
 				SQLite::Transaction transaction(db_);
-				SQLite::Statement removeIt(db_, "DELETE FROM patch_in_list WHERE id = :ID AND synth = :SYN AND md5 = :MD5 AND order_num = :ONO");
-				removeIt.bind(":ID", list_id);
-				removeIt.bind(":SYN", synth_name);
-				removeIt.bind(":MD5", md5);
-				removeIt.bind(":ONO", order_num);
-				removeIt.exec();
-				renumList(list_id);
-				transaction.commit();
+				ListEntry entry;
+				if (listEntryOf(list_id, synth_name, md5, order_num, entry)) {
+					auto cachedRemoveIt = statements_.prepare("DELETE FROM patch_in_list WHERE rowid = :RID");
+					SQLite::Statement& removeIt = *cachedRemoveIt;
+					removeIt.bind(":RID", entry.rowid);
+					removeIt.exec();
+					// Leaving a gap is fine, no renumbering needed
+					transaction.commit();
+					listsChanged();
+				}
 			}
 			catch (SQLite::Exception& ex) {
 				SimpleLogger::instance()->postMessage(fmt::format("DATABASE ERROR in removePatchFromList: SQL Exception {}", ex.what()));
@@ -1333,18 +2789,21 @@ namespace midikraft {
 			try {
 				// Check if it exists
 				SQLite::Transaction transaction(db_);
-				SQLite::Statement search(db_, "SELECT * FROM lists WHERE id = :ID");
+				auto cachedSearch = statements_.prepare("SELECT * FROM lists WHERE id = :ID");
+				SQLite::Statement& search = *cachedSearch;
 				search.bind(":ID", patchList->id());
 				auto isSynthBank = std::dynamic_pointer_cast<SynthBank>(patchList);
 				if (search.executeStep()) {
 					if (!isSynthBank) {
-						SQLite::Statement update(db_, "UPDATE lists SET name = :NAM WHERE id = :ID");
+						auto cachedUpdate = statements_.prepare("UPDATE lists SET name = :NAM WHERE id = :ID");
+						SQLite::Statement& update = *cachedUpdate;
 						update.bind(":ID", patchList->id());
 						update.bind(":NAM", patchList->name());
 						update.exec();
 					}
 					else {
-						SQLite::Statement update(db_, "UPDATE lists SET name = :NAM, last_synced = :LSY WHERE id = :ID");
+						auto cachedUpdate = statements_.prepare("UPDATE lists SET name = :NAM, last_synced = :LSY WHERE id = :ID");
+						SQLite::Statement& update = *cachedUpdate;
 						update.bind(":ID", patchList->id());
 						update.bind(":NAM", patchList->name());
 						if (auto activeBank = std::dynamic_pointer_cast<midikraft::ActiveSynthBank>(patchList)) {
@@ -1356,12 +2815,14 @@ namespace midikraft {
 						update.exec();
 					}
 					// Delete the previous list content, this operation overwrites the list!
-					SQLite::Statement removeEntries(db_, "DELETE FROM patch_in_list WHERE id = :ID");
+					auto cachedRemoveEntries = statements_.prepare("DELETE FROM patch_in_list WHERE id = :ID");
+					SQLite::Statement& removeEntries = *cachedRemoveEntries;
 					removeEntries.bind(":ID", patchList->id());
 					removeEntries.exec();
 				}
 				else {
-					SQLite::Statement insert(db_, "INSERT INTO lists (id, name, synth, midi_bank_number, last_synced) VALUES (:ID, :NAM, :SYN, :BNK, :LSY)");
+					auto cachedInsert = statements_.prepare("INSERT INTO lists (id, name, synth, midi_bank_number, last_synced) VALUES (:ID, :NAM, :SYN, :BNK, :LSY)");
+					SQLite::Statement& insert = *cachedInsert;
 					insert.bind(":ID", patchList->id());
 					insert.bind(":NAM", patchList->name());
 					if (isSynthBank) {
@@ -1383,12 +2844,14 @@ namespace midikraft {
 					insert.exec();
 				}
 				// If this list already has a list of patches, make sure to add them into the patch list as well!
-				int i = 0;
+				int64 orderKey = 0;
 				for (auto patch : patchList->patches()) {
-					addPatchToListInternal(patchList->id(), patch.synth()->getName(), patch.md5(), i++);
+					addPatchToListInternal(patchList->id(), patch.synth()->getName(), patch.md5(), orderKey);
+					orderKey += kListOrderGap;
 				}
 
 				transaction.commit();
+				listsChanged();
 			}
 			catch (SQLite::Exception& ex) {
 				SimpleLogger::instance()->postMessage(fmt::format("DATABASE ERROR in putPatchList: SQL Exception {}", ex.what()));
@@ -1397,50 +2860,69 @@ namespace midikraft {
 
 		void deletePatchlist(ListInfo info) {
 			try {
-				SQLite::Statement deleteMembers(db_, "DELETE FROM patch_in_list WHERE id = :ID");
+				auto cachedDeleteMembers = statements_.prepare("DELETE FROM patch_in_list WHERE id = :ID");
+				SQLite::Statement& deleteMembers = *cachedDeleteMembers;
 				deleteMembers.bind(":ID", info.id);
 				deleteMembers.exec();
-				SQLite::Statement deleteIt(db_, "DELETE FROM lists WHERE id = :ID");
+				auto cachedDeleteIt = statements_.prepare("DELETE FROM lists WHERE id = :ID");
+				SQLite::Statement& deleteIt = *cachedDeleteIt;
 				deleteIt.bind(":ID", info.id);
 				deleteIt.exec();
+				listsChanged();
 			}
 			catch (SQLite::Exception& ex) {
 				SimpleLogger::instance()->postMessage(fmt::format("DATABASE ERROR in deletePatchlist: SQL Exception {}", ex.what()));
 			}
 		}
 
-		void removeAllOrphansFromPatchLists() {
-			try {
-				SQLite::Statement cleanupPatchLists(db_,
-					"delete from patch_in_list as pil where not exists(select * from patches as p where p.md5 = pil.md5 and p.synth = pil.synth)");
-				cleanupPatchLists.exec();
-			}
-			catch (SQLite::Exception& ex) {
-				SimpleLogger::instance()->postMessage(fmt::format("DATABASE ERROR in removeAllOrphansFromPatchLists: SQL Exception {}", ex.what()));
-			}
-		}
-
-
 	private:
 		SQLite::Database db_;
+		StatementCache statements_{ db_, kStatementCacheSize }; // Declared after db_, the statements need to be finalized before the database closes
 		OpenMode mode_;
-		CategoryBitfield bitfield;
-		std::vector<Category> categoryDefinitions_;
-		CriticalSection categoryLock_;
+		DatabaseOpenTimings openTimings_;
+		BackupEngine& backups_;
+		DatabaseInstrumentation& instrumentation_;
+		BackupFormat backupFormat_;
+		bool hasNameSearchIndex_ = false;
+		bool hasCategoryIndex_ = false;
+		std::shared_ptr<const CategoryCache> categoryCache_; // Only access via std::atomic_load/std::atomic_store
+		std::atomic<uint64> categoryReloads_; // Doubles as the version number of the category cache
+		CriticalSection categoryLock_; // Serializes writers of the category cache, readers never lock
+		std::set<std::string> reportedFullScans_;
+		CriticalSection reportedFullScansLock_;
+		std::vector<std::unique_ptr<SQLite::Database>> readConnections_; // Only opened in WAL mode
+		std::map<SQLite::Database*, std::unique_ptr<StatementCache>> readStatements_;
+		std::vector<SQLite::Database*> idleReadConnections_;
+		CriticalSection readConnectionLock_;
+		WaitableEvent readConnectionReturned_;
+		QueryResultCache queryCache_{ kQueryCacheSize, kQueryCachePatchBudget };
+		CriticalSection decodePoolLock_;
+		std::unique_ptr<ThreadPool> decodePool_; // Created on first use by workerPool()
+		std::shared_ptr<PatchSnapshot> snapshot_; // Only with the columnarSnapshot option, kept current by patchesChanged(). Only access via std::atomic_load/std::atomic_store
+		std::atomic<uint64> patchGeneration_{ 0 }; // Bumped by every committed write to patches, imports or categories
+		std::atomic<uint64> listGeneration_{ 0 }; // Bumped by every committed write to lists
 	};
 
-	PatchDatabase::PatchDatabase() {
+	static void logThroughput(std::string const& operation, size_t processed, size_t inserted, double startTimeMilliseconds) {
+		// The ProgressHandler only knows percentages, so the rate goes to the log for bigger operations only
+		double seconds = (Time::getMillisecondCounterHiRes() - startTimeMilliseconds) / 1000.0;
+		if (processed >= kBulkChunkSize && seconds > 0.0) {
+			SimpleLogger::instance()->postMessage(fmt::format("{} {} patches ({} new) in {:.1f} s, {:.0f} patches/s", operation, processed, inserted, seconds, processed / seconds));
+		}
+	}
+
+	PatchDatabase::PatchDatabase() : backups_(std::make_unique<BackupEngine>()) {
 		try {
-			impl.reset(new PatchDataBaseImpl(generateDefaultDatabaseLocation(), OpenMode::READ_WRITE));
+			impl.reset(new PatchDataBaseImpl(generateDefaultDatabaseLocation(), OpenMode::READ_WRITE, DatabaseOpenOptions(), *backups_, instrumentation_));
 		}
 		catch (SQLite::Exception& e) {
 			throw PatchDatabaseException(e.what());
 		}
 	}
 
-	PatchDatabase::PatchDatabase(std::string const& databaseFile, OpenMode mode) {
+	PatchDatabase::PatchDatabase(std::string const& databaseFile, OpenMode mode, DatabaseOpenOptions const& options) : backups_(std::make_unique<BackupEngine>()) {
 		try {
-			impl.reset(new PatchDataBaseImpl(databaseFile, mode));
+			impl.reset(new PatchDataBaseImpl(databaseFile, mode, options, *backups_, instrumentation_));
 		}
 		catch (SQLite::Exception& e) {
 			if (e.getErrorCode() == SQLITE_READONLY) {
@@ -1460,12 +2942,13 @@ namespace midikraft {
 		return impl->databaseFileName();
 	}
 
-	bool PatchDatabase::switchDatabaseFile(std::string const& newDatabaseFile, OpenMode mode)
+	bool PatchDatabase::switchDatabaseFile(std::string const& newDatabaseFile, OpenMode mode, DatabaseOpenOptions const& options)
 	{
 		try {
-			auto newDatabase = new PatchDataBaseImpl(newDatabaseFile, mode);
+			auto newDatabase = new PatchDataBaseImpl(newDatabaseFile, mode, options, *backups_, instrumentation_);
 			// If no exception was thrown, this worked
 			impl.reset(newDatabase);
+			instrumentation_.reset();
 			return true;
 		}
 		catch (SQLite::Exception& ex) {
@@ -1476,15 +2959,20 @@ namespace midikraft {
 
 	int PatchDatabase::getPatchesCount(PatchFilter filter)
 	{
-		return impl->getPatchesCount(filter);
+		DatabaseInstrumentation::Scope measured(instrumentation_, "getPatchesCount");
+		int count = impl->getPatchesCount(filter);
+		measured.setRowsReturned((size_t)count);
+		return count;
 	}
 
 	bool PatchDatabase::getSinglePatch(std::shared_ptr<Synth> synth, std::string const& md5, std::vector<PatchHolder>& result)
 	{
+		DatabaseInstrumentation::Scope measured(instrumentation_, "getSinglePatch");
 		return impl->getSinglePatch(synth, md5, result);
 	}
 
 	bool PatchDatabase::putPatch(PatchHolder const& patch) {
+		DatabaseInstrumentation::Scope measured(instrumentation_, "putPatch");
 		// From the logic, this is an UPSERT (REST call put)
 		// Use the merge functionality for this!
 		std::vector<PatchHolder> newPatches;
@@ -1493,117 +2981,276 @@ namespace midikraft {
 		return impl->mergePatchesIntoDatabase(newPatches, insertedPatches, nullptr, UPDATE_ALL, true);
 	}
 
-	bool PatchDatabase::putPatches(std::vector<PatchHolder> const& patches) {
-		ignoreUnused(patches);
-		jassert(false);
-		return false;
+	bool PatchDatabase::putPatches(std::vector<PatchHolder> const& patches, ProgressHandler* progress) {
+		DatabaseInstrumentation::Scope measured(instrumentation_, "putPatches");
+		// Same UPSERT logic as putPatch, but in chunks with one transaction each so a big import neither holds the write lock for the whole run
+		// nor loses all work when aborted
+		double startTime = Time::getMillisecondCounterHiRes();
+		size_t done = 0;
+		size_t inserted = 0;
+		while (done < patches.size()) {
+			if (progress && progress->shouldAbort()) {
+				return false;
+			}
+			size_t chunkEnd = std::min(done + kBulkChunkSize, patches.size());
+			std::vector<PatchHolder> chunk(patches.begin() + done, patches.begin() + chunkEnd);
+			std::vector<PatchHolder> newPatches;
+			inserted += impl->mergePatchesIntoDatabase(chunk, newPatches, nullptr, UPDATE_ALL, true);
+			done = chunkEnd;
+			if (progress) progress->setProgressPercentage(done / (double)patches.size());
+		}
+		logThroughput("Stored", done, inserted, startTime);
+		return true;
+	}
+
+	ThreadPool& PatchDatabase::workerPool()
+	{
+		return impl->workerPool();
 	}
 
 	std::shared_ptr<AutomaticCategory> PatchDatabase::getCategorizer()
 	{
+		DatabaseInstrumentation::Scope measured(instrumentation_, "getCategorizer");
 		return impl->getCategorizer();
 	}
 
 	int PatchDatabase::getNextBitindex() {
+		DatabaseInstrumentation::Scope measured(instrumentation_, "getNextBitindex");
 		return impl->getNextBitindex();
 	}
 
 	void PatchDatabase::updateCategories(std::vector<CategoryDefinition> const& newdefs)
 	{
+		DatabaseInstrumentation::Scope measured(instrumentation_, "updateCategories");
 		impl->updateCategories(newdefs);
 	}
 
 	std::vector<ListInfo> PatchDatabase::allPatchLists()
 	{
+		DatabaseInstrumentation::Scope measured(instrumentation_, "allPatchLists");
 		return impl->allPatchLists();
 	}
 
 	std::vector<ListInfo> PatchDatabase::allUserBanks(std::shared_ptr<Synth> synth)
 	{
+		DatabaseInstrumentation::Scope measured(instrumentation_, "allUserBanks");
 		return impl->allUserBanks(synth);
 	}
 
 	bool PatchDatabase::doesListExist(std::string listId) {
+		DatabaseInstrumentation::Scope measured(instrumentation_, "doesListExist");
 		return impl->doesListExist(listId);
 	}
 
 	std::shared_ptr<midikraft::PatchList> PatchDatabase::getPatchList(ListInfo info, std::map<std::string, std::weak_ptr<Synth>> synths)
 	{
-		return impl->getPatchList(info, synths);
+		DatabaseInstrumentation::Scope measured(instrumentation_, "getPatchList");
+		auto list = impl->getPatchList(info, synths);
+		if (list) measured.setRowsReturned(list->patches().size());
+		return list;
 	}
 
 	void PatchDatabase::putPatchList(std::shared_ptr<PatchList> patchList)
 	{
+		DatabaseInstrumentation::Scope measured(instrumentation_, "putPatchList");
 		impl->putPatchList(patchList);
 	}
 
 	void PatchDatabase::deletePatchlist(ListInfo info)
 	{
+		DatabaseInstrumentation::Scope measured(instrumentation_, "deletePatchlist");
 		impl->deletePatchlist(info);
 	}
 
 	void PatchDatabase::addPatchToList(ListInfo info, PatchHolder const& patch, int insertIndex)
 	{
+		DatabaseInstrumentation::Scope measured(instrumentation_, "addPatchToList");
 		impl->addPatchToList(info, patch, insertIndex);
 	}
 
 	void PatchDatabase::movePatchInList(ListInfo info, PatchHolder const& patch, int previousIndex, int newIndex)
 	{
+		DatabaseInstrumentation::Scope measured(instrumentation_, "movePatchInList");
 		impl->movePatchInList(info, patch, previousIndex, newIndex);
 	}
 
 	void PatchDatabase::removePatchFromList(std::string const& list_id, std::string const& synth_name, std::string const& md5, int order_num)
 	{
+		DatabaseInstrumentation::Scope measured(instrumentation_, "removePatchFromList");
 		impl->removePatchFromList(list_id, synth_name, md5, order_num);
 	}
 
 	int PatchDatabase::deletePatches(PatchFilter filter)
 	{
+		DatabaseInstrumentation::Scope measured(instrumentation_, "deletePatches");
 		return impl->deletePatches(filter);
 	}
 
 	int PatchDatabase::deletePatches(std::string const& synth, std::vector<std::string> const& md5s)
 	{
+		DatabaseInstrumentation::Scope measured(instrumentation_, "deletePatchesByMd5");
 		return impl->deletePatches(synth, md5s);
 	}
 
-	int PatchDatabase::reindexPatches(PatchFilter filter)
+	int PatchDatabase::reindexPatches(PatchFilter filter, ProgressHandler* progress, PatchPageToken* resumeFrom)
 	{
-		return impl->reindexPatches(filter);
+		DatabaseInstrumentation::Scope measured(instrumentation_, "reindexPatches");
+		return impl->reindexPatches(filter, progress, resumeFrom);
 	}
 
 	std::vector<PatchHolder> PatchDatabase::getPatches(PatchFilter filter, int skip, int limit)
 	{
-		std::vector<PatchHolder> result;
-		std::vector<std::pair<std::string, PatchHolder>> faultyIndexedPatches;
-		bool success = impl->getPatches(filter, result, faultyIndexedPatches, skip, limit);
-		if (success) {
-			if (!faultyIndexedPatches.empty()) {
-				SimpleLogger::instance()->postMessage(fmt::format("Found {} patches with inconsistent MD5 - please run the Edit... Reindex Patches command for this synth", faultyIndexedPatches.size()));
-			}
-			return result;
-		}
-		else {
-			return {};
-		}
+		DatabaseInstrumentation::Scope measured(instrumentation_, "getPatches");
+		auto result = impl->getPatchesPage(filter, skip, limit, nullptr, false);
+		measured.setRowsReturned(result.size());
+		return result;
 	}
 
 	void PatchDatabase::getPatchesAsync(PatchFilter filter, std::function<void(PatchFilter const filteredBy, std::vector<PatchHolder> const&)> finished, int skip, int limit)
 	{
-		pool_.addJob([this, filter, finished, skip, limit]() {
-			auto result = getPatches(filter, skip, limit);
-			MessageManager::callAsync([filter, finished, result]() {
+		auto generation = registerAsyncQuery(filter);
+		pool_.addJob([this, filter, finished, skip, limit, generation]() {
+			PatchDataBaseImpl::QueryControl control;
+			control.shouldAbort = [this, generation]() { return isSuperseded(generation); };
+			if (control.shouldAbort()) return;
+			DatabaseInstrumentation::Scope measured(instrumentation_, "getPatchesAsync");
+			auto result = impl->getPatchesPage(filter, skip, limit, nullptr, true, &control);
+			measured.setRowsReturned(result.size());
+			if (control.shouldAbort()) return;
+			MessageManager::callAsync([filter, finished, result = std::move(result)]() {
 				finished(filter, result);
 				});
 			});
 	}
 
+	std::vector<PatchHolder> PatchDatabase::getPatches(PatchFilter filter, PatchPageToken& page, int limit)
+	{
+		DatabaseInstrumentation::Scope measured(instrumentation_, "getPatchesKeyset");
+		auto result = impl->getPatchesPage(filter, 0, limit, &page, false);
+		measured.setRowsReturned(result.size());
+		return result;
+	}
+
+	void PatchDatabase::getPatchesAsync(PatchFilter filter, PatchPageToken page, std::function<void(PatchFilter const filteredBy, std::vector<PatchHolder> const&, PatchPageToken const nextPage)> finished, int limit)
+	{
+		auto generation = registerAsyncQuery(filter);
+		pool_.addJob([this, filter, page, finished, limit, generation]() {
+			PatchDataBaseImpl::QueryControl control;
+			control.shouldAbort = [this, generation]() { return isSuperseded(generation); };
+			if (control.shouldAbort()) return;
+			PatchPageToken nextPage = page;
+			DatabaseInstrumentation::Scope measured(instrumentation_, "getPatchesAsyncKeyset");
+			auto result = impl->getPatchesPage(filter, 0, limit, &nextPage, true, &control);
+			measured.setRowsReturned(result.size());
+			if (control.shouldAbort()) return;
+			MessageManager::callAsync([filter, finished, result = std::move(result), nextPage]() {
+				finished(filter, result, nextPage);
+				});
+			});
+	}
+
+	void PatchDatabase::getPatchesAsyncStreamed(PatchFilter filter, std::function<void(PatchFilter const filteredBy, std::vector<PatchHolder> const& chunk)> chunkLoaded, std::function<void(PatchFilter const filteredBy)> finished, int skip, int limit, size_t chunkSize)
+	{
+		auto generation = registerAsyncQuery(filter);
+		pool_.addJob([this, filter, chunkLoaded, finished, skip, limit, chunkSize, generation]() {
+			PatchDataBaseImpl::QueryControl control;
+			control.shouldAbort = [this, generation]() { return isSuperseded(generation); };
+			if (control.shouldAbort()) return;
+			control.chunkSize = std::max(chunkSize, (size_t) 1);
+			control.chunkLoaded = [filter, chunkLoaded](std::vector<PatchHolder>&& chunk) {
+				MessageManager::callAsync([filter, chunkLoaded, chunk = std::move(chunk)]() {
+					chunkLoaded(filter, chunk);
+					});
+			};
+			{
+				DatabaseInstrumentation::Scope measured(instrumentation_, "getPatchesAsyncStreamed");
+				impl->getPatchesPage(filter, skip, limit, nullptr, true, &control);
+			}
+			if (control.shouldAbort()) return;
+			// Posted after the last chunk, and the message thread keeps the order
+			MessageManager::callAsync([filter, finished]() {
+				finished(filter);
+				});
+			});
+	}
+
+	uint64 PatchDatabase::registerAsyncQuery(PatchFilter const& filter)
+	{
+		// A request with a different filter than the one before makes all earlier requests obsolete. Requests for the same filter, e.g. 
+		// several pages while scrolling, all stay alive
+		ScopedLock lock(asyncFilterLock_);
+		uint64 generation = ++asyncGeneration_;
+		if (generation == 1 || latestAsyncFilter_ != filter) {
+			latestAsyncFilter_ = filter;
+			lastFilterChange_ = generation;
+		}
+		return generation;
+	}
+
+	bool PatchDatabase::isSuperseded(uint64 generation) const
+	{
+		return generation < lastFilterChange_.load();
+	}
+
+	std::vector<PatchMetaData> PatchDatabase::getPatchesMetaData(PatchFilter filter, int skip, int limit)
+	{
+		DatabaseInstrumentation::Scope measured(instrumentation_, "getPatchesMetaData");
+		std::vector<PatchMetaData> result;
+		if (impl->getPatchesMetaData(filter, result, skip, limit, nullptr)) {
+			measured.setRowsReturned(result.size());
+			return result;
+		}
+		return {};
+	}
+
+	std::vector<PatchMetaData> PatchDatabase::getPatchesMetaData(PatchFilter filter, PatchPageToken& page, int limit)
+	{
+		DatabaseInstrumentation::Scope measured(instrumentation_, "getPatchesMetaDataKeyset");
+		std::vector<PatchMetaData> result;
+		if (impl->getPatchesMetaData(filter, result, 0, limit, &page)) {
+			measured.setRowsReturned(result.size());
+			return result;
+		}
+		return {};
+	}
+
+	std::vector<PatchHolder> PatchDatabase::loadPatches(std::vector<PatchMetaData> const& rows, std::map<std::string, std::weak_ptr<Synth>> synths)
+	{
+		DatabaseInstrumentation::Scope measured(instrumentation_, "loadPatches");
+		auto result = impl->loadPatches(rows, synths);
+		measured.setRowsReturned(result.size());
+		return result;
+	}
+
+	bool PatchDatabase::getPatchIds(PatchFilter filter, std::vector<int64>& outIds, int skip, int limit)
+	{
+		DatabaseInstrumentation::Scope measured(instrumentation_, "getPatchIds");
+		if (impl->getPatchIds(filter, outIds, skip, limit)) {
+			measured.setRowsReturned(outIds.size());
+			return true;
+		}
+		return false;
+	}
+
+	std::vector<PatchHolder> PatchDatabase::loadPatchesById(std::vector<int64> const& ids, std::map<std::string, std::weak_ptr<Synth>> synths)
+	{
+		DatabaseInstrumentation::Scope measured(instrumentation_, "loadPatchesById");
+		auto result = impl->loadPatchesById(ids, synths);
+		measured.setRowsReturned(result.size());
+		return result;
+	}
+
 	size_t PatchDatabase::mergePatchesIntoDatabase(std::vector<PatchHolder>& patches, std::vector<PatchHolder>& outNewPatches, ProgressHandler* progress, unsigned updateChoice)
 	{
-		return impl->mergePatchesIntoDatabase(patches, outNewPatches, progress, updateChoice, true);
+		DatabaseInstrumentation::Scope measured(instrumentation_, "mergePatchesIntoDatabase");
+		double startTime = Time::getMillisecondCounterHiRes();
+		auto inserted = impl->mergePatchesIntoDatabase(patches, outNewPatches, progress, updateChoice, true);
+		logThroughput("Merged", patches.size(), inserted, startTime);
+		return inserted;
 	}
 
 	std::vector<ImportInfo> PatchDatabase::getImportsList(Synth* activeSynth) const {
+		DatabaseInstrumentation::Scope measured(instrumentation_, "getImportsList");
 		if (activeSynth) {
 			return impl->getImportsList(activeSynth);
 		}
@@ -1621,11 +3268,13 @@ namespace midikraft {
 	}
 
 	std::string PatchDatabase::makeDatabaseBackup(std::string const& suffix) {
+		DatabaseInstrumentation::Scope measured(instrumentation_, "makeDatabaseBackup");
 		return impl->makeDatabaseBackup(suffix);
 	}
 
 	void PatchDatabase::makeDatabaseBackup(File backupFileToCreate)
 	{
+		DatabaseInstrumentation::Scope measured(instrumentation_, "makeDatabaseBackupToFile");
 		impl->makeDatabaseBackup(backupFileToCreate);
 	}
 
@@ -1634,14 +3283,49 @@ namespace midikraft {
 		PatchDataBaseImpl::makeDatabaseBackup(databaseFile, backupFileToCreate);
 	}
 
+	bool PatchDatabase::restoreDatabaseBackup(File backupFile, File databaseFileToCreate)
+	{
+		return BackupEngine::restoreBackup(backupFile, databaseFileToCreate);
+	}
+
 	bool PatchDatabase::renameImport(std::string importID, std::string newName) {
+		DatabaseInstrumentation::Scope measured(instrumentation_, "renameImport");
 		return impl->renameImport(importID, newName);
 	}
 
 	std::vector<Category> PatchDatabase::getCategories() const {
+		DatabaseInstrumentation::Scope measured(instrumentation_, "getCategories");
 		return impl->getCategories();
 	}
 
+	QueryCacheStats PatchDatabase::getQueryCacheStats() const {
+		return impl->queryCacheStats();
+	}
+
+	void PatchDatabase::setQueryCacheSize(size_t entries) {
+		impl->setQueryCacheSize(entries);
+	}
+
+	uint64 PatchDatabase::getCategoryReloadCount() const {
+		return impl->categoryReloadCount();
+	}
+
+	DatabaseOpenTimings PatchDatabase::getOpenTimings() const {
+		return impl->openTimings();
+	}
+
+	DatabaseStats PatchDatabase::getStats() const {
+		return instrumentation_.stats();
+	}
+
+	void PatchDatabase::resetStats() {
+		instrumentation_.reset();
+	}
+
+	void PatchDatabase::setSlowQueryThreshold(double milliseconds) {
+		instrumentation_.setSlowQueryThreshold(milliseconds);
+	}
+
 	PatchFilter PatchDatabase::allForSynth(std::shared_ptr<Synth> synth)
 	{
 		PatchFilter filter;
@@ -8,6 +8,7 @@
 
 #include <memory>
 #include <vector>
+#include <atomic>
 
 #include "Synth.h"
 
@@ -16,6 +17,10 @@
 #include "PatchList.h"
 #include "PatchFilter.h"
 #include "CategoryBitfield.h"
+#include "QueryResultCache.h"
+#include "BackupEngine.h"
+#include "BackupRetention.h"
+#include "DatabaseInstrumentation.h"
 #include "Category.h"
 
 namespace midikraft {
@@ -31,6 +36,53 @@ namespace midikraft {
 		std::string name; // The given name of the list
 	};
 
+	// Cursor for keyset pagination with getPatches. Start with a default constructed token, every call advances it past the rows returned.
+	// Treat the content as opaque, it is only valid for the filter it was used with
+	struct PatchPageToken {
+		PatchOrdering orderBy = PatchOrdering::No_ordering;
+		std::vector<var> lastKey; // Sort key of the last row delivered, empty before the first page
+		bool endReached = false; // True when the last call returned the final rows
+	};
+
+	// Everything stored about a patch except its sysex data. Browsing with these is much cheaper than with PatchHolders, as neither the BLOB is read 
+	// nor the patch is created by the synth. Use PatchDatabase::loadPatches to turn the rows actually needed into PatchHolders
+	struct PatchMetaData {
+		std::string synthName;
+		std::string md5;
+		std::string name;
+		int type = 0;
+		Favorite::TFavorite favorite = Favorite::TFavorite::DONTKNOW;
+		bool hidden = false;
+		std::string sourceID;
+		std::string sourceName;
+		int midiBankNo = -1; // -1 if no bank is stored
+		int midiProgramNo = 0;
+		std::set<Category> categories;
+		std::set<Category> userDecisions;
+	};
+
+	// Opt-in settings for opening a database file
+	struct DatabaseOpenOptions {
+		bool writeAheadLog = false; // Use SQLite's WAL journal mode, so readers neither wait for writers nor block them
+		int readConnections = 2; // With writeAheadLog, the number of read only connections used by getPatchesAsync
+		BackupFormat backupFormat = BackupFormat::Plain; // Format of the automatic backup made when the database is closed
+		RetentionPolicy backupRetention; // Applied to the automatic backups whenever a database is opened
+		bool fastOpen = false; // Check the schema with a single header read when possible, and run the backup retention in the background
+		bool columnarSnapshot = false; // Keep the metadata of all patches in memory, so counts and pages of most filters don't need to query SQLite
+	};
+
+	// Milliseconds spent in the phases of opening a database file
+	struct DatabaseOpenTimings {
+		bool fastOpen = false;
+		double journalMode = 0.0;
+		double schema = 0.0; // Schema check, including migrations
+		double retention = 0.0; // Deleting old backups, only queued with fastOpen
+		double categories = 0.0;
+		double readConnections = 0.0;
+		double snapshot = 0.0; // Loading the columnar snapshot, if enabled
+		double total = 0.0;
+	};
+
 	class PatchDatabaseException : public std::runtime_error {
 		using std::runtime_error::runtime_error;
 	};
@@ -57,35 +109,63 @@ namespace midikraft {
 		};
 
 		PatchDatabase(); // Default location
-		PatchDatabase(std::string const &databaseFile, OpenMode mode); // Specific file
+		PatchDatabase(std::string const &databaseFile, OpenMode mode, DatabaseOpenOptions const &options = DatabaseOpenOptions()); // Specific file
 		~PatchDatabase();
 
 		std::string getCurrentDatabaseFileName() const;
-		bool switchDatabaseFile(std::string const &newDatabaseFile, OpenMode mode);
+		bool switchDatabaseFile(std::string const &newDatabaseFile, OpenMode mode, DatabaseOpenOptions const &options = DatabaseOpenOptions());
 
 		int getPatchesCount(PatchFilter filter);
 		bool getSinglePatch(std::shared_ptr<Synth> synth, std::string const& md5, std::vector<PatchHolder>& result);
 		std::vector<PatchHolder> getPatches(PatchFilter filter, int skip, int limit);
 
+		// Asynchronous queries run on a read connection and call back on the message thread. A query is cancelled without any callback
+		// as soon as a query with a different filter is requested, so typing into a filter doesn't queue up stale queries
 		void getPatchesAsync(PatchFilter filter, std::function<void(PatchFilter const filteredBy, std::vector<PatchHolder> const &)> finished, int skip, int limit);
+		// Streaming variant - delivers the patches in chunks as they are decoded, and calls finished after the last chunk
+		void getPatchesAsyncStreamed(PatchFilter filter, std::function<void(PatchFilter const filteredBy, std::vector<PatchHolder> const &chunk)> chunkLoaded, std::function<void(PatchFilter const filteredBy)> finished, int skip, int limit, size_t chunkSize = 100);
+
+		// Keyset pagination - continue after the page token and advance it, so the cost of a page does not depend on how deep it is
+		std::vector<PatchHolder> getPatches(PatchFilter filter, PatchPageToken &page, int limit);
+		void getPatchesAsync(PatchFilter filter, PatchPageToken page, std::function<void(PatchFilter const filteredBy, std::vector<PatchHolder> const &, PatchPageToken const nextPage)> finished, int limit);
+
+		// Metadata only projection, loads the patch data only for the rows given to loadPatches
+		std::vector<PatchMetaData> getPatchesMetaData(PatchFilter filter, int skip, int limit);
+		std::vector<PatchMetaData> getPatchesMetaData(PatchFilter filter, PatchPageToken &page, int limit);
+		std::vector<PatchHolder> loadPatches(std::vector<PatchMetaData> const &rows, std::map<std::string, std::weak_ptr<Synth>> synths);
+
+		// Only with the columnarSnapshot option. The ids of a page of the filter result, answered from memory. Returns false if there is no snapshot
+		// or the filter needs SQL (lists, LIKE wildcards or non-ASCII characters in the name). The ids are rowids of the patches table, valid until the database is vacuumed
+		bool getPatchIds(PatchFilter filter, std::vector<int64> &outIds, int skip = 0, int limit = -1);
+		std::vector<PatchHolder> loadPatchesById(std::vector<int64> const &ids, std::map<std::string, std::weak_ptr<Synth>> synths); // In the order of the ids
 
 		size_t mergePatchesIntoDatabase(std::vector<PatchHolder> &patches, std::vector<PatchHolder> &outNewPatches, ProgressHandler *progress, unsigned updateChoice);
 		std::vector<ImportInfo> getImportsList(Synth *activeSynth) const;
 		bool putPatch(PatchHolder const &patch);
-		bool putPatches(std::vector<PatchHolder> const &patches);
+		bool putPatches(std::vector<PatchHolder> const &patches, ProgressHandler *progress = nullptr);
 
 		int deletePatches(PatchFilter filter);
 		int deletePatches(std::string const& synth, std::vector<std::string> const& md5s);
-		int reindexPatches(PatchFilter filter);
+		// Reindexes in chunks, each committed on its own. Pass a page token to continue an aborted run where it stopped, it is advanced after every chunk
+		int reindexPatches(PatchFilter filter, ProgressHandler *progress = nullptr, PatchPageToken *resumeFrom = nullptr);
 
 		std::string makeDatabaseBackup(std::string const &suffix);
 		void makeDatabaseBackup(File backupFileToCreate);
 		static void makeDatabaseBackup(File databaseFile, File backupFileToCreate);
+		static bool restoreDatabaseBackup(File backupFile, File databaseFileToCreate); // Any backup format, plain copies or compressed and deduplicated backups
 
 		bool renameImport(std::string importID, std::string newName);
 
 		std::vector<Category> getCategories() const;
+		uint64 getCategoryReloadCount() const; // Number of times the categories table was read, for profiling the category cache
+		DatabaseOpenTimings getOpenTimings() const; // Of the currently open database file
+		QueryCacheStats getQueryCacheStats() const; // Hit and miss counts of the getPatchesCount/getPatches result cache, for tuning its size
+		void setQueryCacheSize(size_t entries); // 0 disables the cache
+		DatabaseStats getStats() const; // Calls, latencies and SQLite counters per method plus the slow query log, since opening the database file or resetStats
+		void resetStats();
+		void setSlowQueryThreshold(double milliseconds); // Statements slower than this are logged with their query plan, negative disables
 		std::shared_ptr<AutomaticCategory> getCategorizer();
+		ThreadPool &workerPool(); // Shared by the pipelined getPatches, the columnar snapshot and the bulk transfers for their CPU bound work, created on first use
 		int getNextBitindex();
 		void updateCategories(std::vector<CategoryDefinition> const &newdefs);
 
@@ -95,6 +175,8 @@ namespace midikraft {
 		std::shared_ptr<PatchList> getPatchList(ListInfo info, std::map<std::string, std::weak_ptr<Synth>> synths);
 		void putPatchList(std::shared_ptr<PatchList> patchList);
 		void deletePatchlist(ListInfo info);
+		// All list indexes are positions in the list, not the order_num values stored in the database. A negative insertIndex appends to the list,
+		// which is cheaper than passing the size of the list as it doesn't need to look at the other entries
 		void addPatchToList(ListInfo info, PatchHolder const& patch, int insertIndex);
 		void movePatchInList(ListInfo info, PatchHolder const& patch, int previousIndex, int newIndex);
 		void removePatchFromList(std::string const &list_id, std::string const &synth_name, std::string const &md5, int order_num);
@@ -107,9 +189,18 @@ namespace midikraft {
 		static std::string generateDefaultDatabaseLocation();
 
 	private:
+		uint64 registerAsyncQuery(PatchFilter const &filter);
+		bool isSuperseded(uint64 generation) const;
+
 		class PatchDataBaseImpl;
+		std::unique_ptr<BackupEngine> backups_; // Declared before impl, closing a database queues its backup here
+		mutable DatabaseInstrumentation instrumentation_; // Declared before impl, which records its statements here
 		std::unique_ptr<PatchDataBaseImpl> impl;
-		ThreadPool pool_;
+		std::atomic<uint64> asyncGeneration_{ 0 };
+		std::atomic<uint64> lastFilterChange_{ 0 };
+		PatchFilter latestAsyncFilter_;
+		CriticalSection asyncFilterLock_;
+		ThreadPool pool_; // Declared last so it is destroyed first, the jobs use the members above
 	};
 
 
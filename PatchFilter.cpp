@@ -38,5 +38,29 @@ namespace midikraft {
 			|| a.onlyUntagged != b.onlyUntagged;
 	}
 
+	std::string filterCacheKey(PatchFilter const& filter)
+	{
+		// Free text goes last and is length prefixed, so no separator inside a name or ID can make two different filters look the same
+		std::string key;
+		for (auto const& synth : filter.synths) {
+			key += std::to_string(synth.first.size()) + ":" + synth.first + ",";
+		}
+		key += "|o" + std::to_string(static_cast<int>(filter.orderBy));
+		key += "|f" + std::to_string(filter.onlyFaves ? 1 : 0);
+		key += "|t" + (filter.onlySpecifcType ? std::to_string(filter.typeID) : std::string("-"));
+		key += "|h" + std::to_string(filter.showHidden ? 1 : 0);
+		key += "|u" + std::to_string(filter.onlyUntagged ? 1 : 0);
+		key += "|a" + std::to_string(filter.andCategories ? 1 : 0);
+		key += "|d" + std::to_string(filter.onlyDuplicateNames ? 1 : 0);
+		key += "|c";
+		for (auto const& category : filter.categories) {
+			key += std::to_string(category.category().size()) + ":" + category.category() + ",";
+		}
+		key += "|i" + std::to_string(filter.importID.size()) + ":" + filter.importID;
+		key += "|l" + std::to_string(filter.listID.size()) + ":" + filter.listID;
+		key += "|n" + std::to_string(filter.name.size()) + ":" + filter.name;
+		return key;
+	}
+
 
 }
\ No newline at end of file
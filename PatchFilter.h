@@ -38,4 +38,8 @@ namespace midikraft {
 	// Inequality operator for patch filters - this can be used to e.g. match if a database query result is for a specific filter setup
 	bool operator !=(PatchFilter const& a, PatchFilter const& b);
 
+	// Canonical string describing everything that influences the result of a query with this filter, including the ordering. 
+	// Two filters with the same key return the same patches in the same order, so this can be used as a cache key
+	std::string filterCacheKey(PatchFilter const& filter);
+
 }
\ No newline at end of file
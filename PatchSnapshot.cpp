@@ -0,0 +1,487 @@
+/*
+   Copyright (c) 2021 Christof Ruch. All rights reserved.
+
+   Dual licensed: Distributed under Affero GPL license by default, an MIT license is available for purchase
+*/
+
+#include "PatchSnapshot.h"
+
+#include "ParallelJobs.h"
+#include "Logger.h"
+
+#include "fmt/format.h"
+
+#include <algorithm>
+#include <atomic>
+#include <limits>
+#include <numeric>
+#include <set>
+#include <stdexcept>
+
+namespace midikraft {
+
+	const uint8 kFlagAlive = 1;
+	const uint8 kFlagFavorite = 2;
+	const uint8 kFlagHidden = 4;
+	const uint8 kFlagExtendedCategories = 8; // Has an assigned category outside of the bitfield
+	const int32 kNullType = std::numeric_limits<int32>::min();
+	// Below this, a scan is faster than handing it to the pool
+	const size_t kParallelScanRows = 65536;
+	const size_t kRefreshChunkSize = 500;
+	// Dead rows are removed when there are more than this, and they are more than a quarter of all rows
+	const size_t kCompactDeadRows = 1024;
+
+	struct PatchSnapshot::Criteria {
+		bool none = false; // Nothing can match, e.g. an import ID not in the database
+		std::vector<uint8> synthAllowed; // By synth id
+		bool byImport = false;
+		uint32 import = 0;
+		bool byType = false;
+		int32 type = 0;
+		uint8 flagMask = kFlagAlive;
+		uint8 flagValue = kFlagAlive;
+		int64 anyCategories = 0;
+		int64 allCategories = 0;
+		bool untagged = false;
+		std::shared_ptr<const std::vector<uint8>> names; // By name id, null without a name filter
+		bool duplicates = false;
+		bool countHidden = false;
+	};
+
+	PatchSnapshot::Dictionary::Dictionary()
+	{
+		values.push_back(std::string());
+	}
+
+	uint32 PatchSnapshot::Dictionary::idFor(SQLite::Column const &column)
+	{
+		if (column.isNull()) {
+			return 0;
+		}
+		std::string value = column.getString();
+		auto found = ids.find(value);
+		if (found != ids.end()) {
+			return found->second;
+		}
+		uint32 id = (uint32)values.size();
+		values.push_back(value);
+		ids.emplace(value, id);
+		return id;
+	}
+
+	int64 PatchSnapshot::Dictionary::find(std::string const &value) const
+	{
+		auto found = ids.find(value);
+		return found != ids.end() ? (int64)found->second : -1;
+	}
+
+	PatchSnapshot::PatchSnapshot(ThreadPool &pool) : deadRows_(0), hasCategoryIndex_(false), lastNameDictionarySize_(0), pool_(pool)
+	{
+	}
+
+	PatchSnapshot::~PatchSnapshot()
+	{
+	}
+
+	std::string PatchSnapshot::selectColumns(bool hasCategoryIndex)
+	{
+		std::string columns = "SELECT rowid, synth, name, type, favorite, hidden, sourceID, midiBankNo, midiProgramNo, categories";
+		if (hasCategoryIndex) {
+			columns += fmt::format(", EXISTS (SELECT 1 FROM patch_category AS pc WHERE pc.synth = patches.synth AND pc.md5 = patches.md5 AND pc.bitIndex >= {} AND pc.assigned = 1)",
+				CategoryBitfield::kBitfieldSize);
+		}
+		else {
+			columns += ", 0";
+		}
+		return columns + " FROM patches";
+	}
+
+	void PatchSnapshot::readRow(SQLite::Statement &query, size_t row)
+	{
+		rowid_[row] = query.getColumn(0).getInt64();
+		synth_[row] = (uint16)synths_.idFor(query.getColumn(1));
+		name_[row] = names_.idFor(query.getColumn(2));
+		auto type = query.getColumn(3);
+		type_[row] = type.isNull() ? kNullType : type.getInt();
+		uint8 flags = kFlagAlive;
+		if (query.getColumn(4).getInt() == 1) flags |= kFlagFavorite; // NULL reads as 0
+		if (query.getColumn(5).getInt() == 1) flags |= kFlagHidden;
+		if (query.getColumn(10).getInt() != 0) flags |= kFlagExtendedCategories;
+		flags_[row] = flags;
+		import_[row] = imports_.idFor(query.getColumn(6));
+		auto bank = query.getColumn(7);
+		bank_[row] = bank.isNull() ? -1 : bank.getInt();
+		program_[row] = query.getColumn(8).getInt();
+		categories_[row] = query.getColumn(9).getInt64();
+	}
+
+	void PatchSnapshot::countName(size_t row, int delta)
+	{
+		// Like the name_counts triggers, patches without synth or name are not counted
+		if (synth_[row] == 0 || name_[row] == 0) {
+			return;
+		}
+		uint64 key = ((uint64)synth_[row] << 32) | name_[row];
+		auto &counts = nameCounts_[key];
+		counts.count += delta;
+		if (!(flags_[row] & kFlagHidden)) {
+			counts.visible += delta;
+		}
+		if (counts.count <= 0) {
+			nameCounts_.erase(key);
+		}
+	}
+
+	void PatchSnapshot::clearDerived()
+	{
+		// Call with the write lock held
+		ScopedLock lock(derivedLock_);
+		byName_.reset();
+		byImport_.reset();
+	}
+
+	void PatchSnapshot::load(SQLite::Database &db, bool hasCategoryIndex)
+	{
+		ScopedWriteLock lock(lock_);
+		double startTime = Time::getMillisecondCounterHiRes();
+		rowid_.clear(); synth_.clear(); import_.clear(); name_.clear(); type_.clear(); bank_.clear(); program_.clear(); categories_.clear(); flags_.clear();
+		rowOfId_.clear();
+		nameCounts_.clear();
+		synths_ = Dictionary();
+		imports_ = Dictionary();
+		names_ = Dictionary();
+		deadRows_ = 0;
+		hasCategoryIndex_ = hasCategoryIndex;
+		{
+			ScopedLock derivedLock(derivedLock_);
+			lastNameMatches_.reset();
+		}
+		clearDerived();
+
+		size_t expected = (size_t)db.execAndGet("SELECT count(*) FROM patches").getInt64();
+		for (auto column : { &rowid_, &categories_ }) column->reserve(expected);
+		for (auto column : { &import_, &name_ }) column->reserve(expected);
+		for (auto column : { &type_, &bank_, &program_ }) column->reserve(expected);
+		synth_.reserve(expected);
+		flags_.reserve(expected);
+		rowOfId_.reserve(expected);
+
+		SQLite::Statement query(db, selectColumns(hasCategoryIndex));
+		while (query.executeStep()) {
+			size_t row = rowid_.size();
+			rowid_.push_back(0); synth_.push_back(0); import_.push_back(0); name_.push_back(0); type_.push_back(0); bank_.push_back(0); program_.push_back(0);
+			categories_.push_back(0); flags_.push_back(0);
+			readRow(query, row);
+			rowOfId_.emplace(rowid_[row], row);
+			countName(row, 1);
+		}
+		SimpleLogger::instance()->postMessage(fmt::format("Loaded metadata snapshot of {} patches in {:.0f} ms", rowid_.size(), Time::getMillisecondCounterHiRes() - startTime));
+	}
+
+	void PatchSnapshot::refresh(SQLite::Database &db, bool hasCategoryIndex, std::vector<int64> const &rowids)
+	{
+		if (rowids.empty()) {
+			return;
+		}
+		ScopedWriteLock lock(lock_);
+		hasCategoryIndex_ = hasCategoryIndex;
+		// Everything not read back does not exist anymore
+		std::set<int64> missing(rowids.begin(), rowids.end());
+		for (size_t chunkStart = 0; chunkStart < rowids.size(); chunkStart += kRefreshChunkSize) {
+			size_t chunkEnd = std::min(chunkStart + kRefreshChunkSize, rowids.size());
+			std::string placeholders;
+			for (size_t i = chunkStart; i < chunkEnd; i++) {
+				placeholders += i == chunkStart ? "?" : ", ?";
+			}
+			SQLite::Statement query(db, selectColumns(hasCategoryIndex) + " WHERE rowid IN (" + placeholders + ")");
+			for (size_t i = chunkStart; i < chunkEnd; i++) {
+				query.bind((int)(i - chunkStart + 1), (long long)rowids[i]);
+			}
+			while (query.executeStep()) {
+				int64 rowid = query.getColumn(0).getInt64();
+				missing.erase(rowid);
+				auto existing = rowOfId_.find(rowid);
+				size_t row;
+				if (existing != rowOfId_.end()) {
+					row = existing->second;
+					countName(row, -1);
+				}
+				else {
+					row = rowid_.size();
+					rowid_.push_back(0); synth_.push_back(0); import_.push_back(0); name_.push_back(0); type_.push_back(0); bank_.push_back(0); program_.push_back(0);
+					categories_.push_back(0); flags_.push_back(0);
+					rowOfId_.emplace(rowid, row);
+				}
+				readRow(query, row);
+				countName(row, 1);
+			}
+		}
+		for (auto rowid : missing) {
+			auto existing = rowOfId_.find(rowid);
+			if (existing != rowOfId_.end()) {
+				countName(existing->second, -1);
+				flags_[existing->second] = 0;
+				rowOfId_.erase(existing);
+				deadRows_++;
+			}
+		}
+		clearDerived();
+		compactIfNeeded();
+	}
+
+	void PatchSnapshot::compactIfNeeded()
+	{
+		// Call with the write lock held. Keeps the order of the rows, which is the order for No_ordering
+		if (deadRows_ < kCompactDeadRows || deadRows_ * 4 < rowid_.size()) {
+			return;
+		}
+		size_t target = 0;
+		for (size_t row = 0; row < rowid_.size(); row++) {
+			if (!(flags_[row] & kFlagAlive)) continue;
+			rowid_[target] = rowid_[row];
+			synth_[target] = synth_[row];
+			import_[target] = import_[row];
+			name_[target] = name_[row];
+			type_[target] = type_[row];
+			bank_[target] = bank_[row];
+			program_[target] = program_[row];
+			categories_[target] = categories_[row];
+			flags_[target] = flags_[row];
+			rowOfId_[rowid_[target]] = target;
+			target++;
+		}
+		rowid_.resize(target); synth_.resize(target); import_.resize(target); name_.resize(target); type_.resize(target); bank_.resize(target); program_.resize(target);
+		categories_.resize(target); flags_.resize(target);
+		deadRows_ = 0;
+		clearDerived();
+	}
+
+	size_t PatchSnapshot::size() const
+	{
+		ScopedReadLock lock(lock_);
+		return rowid_.size() - deadRows_;
+	}
+
+	bool PatchSnapshot::canEvaluate(PatchFilter const &filter, CategoryBitfield const &bitfield)
+	{
+		if (!filter.listID.empty() || filter.orderBy == PatchOrdering::Order_by_Place_in_List) {
+			return false;
+		}
+		if (filter.name.find_first_of("%_") != std::string::npos) {
+			return false;
+		}
+		// LIKE folds only the ASCII letters, while the trigram index folds all of Unicode. Only for ASCII names both agree with the snapshot
+		for (unsigned char c : filter.name) {
+			if (c >= 0x80) {
+				return false;
+			}
+		}
+		if (!filter.onlyUntagged) {
+			for (auto const &category : filter.categories) {
+				if (bitfield.bitIndexForCategory(category) >= CategoryBitfield::kBitfieldSize) {
+					return false;
+				}
+			}
+		}
+		return true;
+	}
+
+	PatchSnapshot::Criteria PatchSnapshot::criteria(PatchFilter const &filter, CategoryBitfield const &bitfield) const
+	{
+		Criteria result;
+		result.synthAllowed.assign(synths_.values.size(), filter.synths.empty() ? 1 : 0);
+		for (auto const &synth : filter.synths) {
+			int64 id = synths_.find(synth.first);
+			if (id >= 0) {
+				result.synthAllowed[(size_t)id] = 1;
+			}
+		}
+		if (!filter.importID.empty()) {
+			int64 id = imports_.find(filter.importID);
+			result.none = result.none || id < 0;
+			result.byImport = true;
+			result.import = (uint32)std::max((int64)0, id);
+		}
+		if (filter.onlySpecifcType) {
+			result.byType = true;
+			result.type = filter.typeID;
+		}
+		if (filter.onlyFaves) {
+			result.flagMask |= kFlagFavorite;
+			result.flagValue |= kFlagFavorite;
+		}
+		if (!filter.showHidden) {
+			result.flagMask |= kFlagHidden;
+		}
+		if (filter.onlyUntagged) {
+			result.untagged = true;
+			result.flagMask |= kFlagExtendedCategories;
+		}
+		else if (!filter.categories.empty()) {
+			// A category without bit index matches nothing in the patch_category table, while the bitfield of the fallback just leaves it out
+			for (auto const &category : filter.categories) {
+				int bitIndex = bitfield.bitIndexForCategory(category);
+				if (bitIndex < 0) {
+					result.none = result.none || (filter.andCategories && hasCategoryIndex_);
+					continue;
+				}
+				if (filter.andCategories) {
+					result.allCategories |= 1LL << bitIndex;
+				}
+				else {
+					result.anyCategories |= 1LL << bitIndex;
+				}
+			}
+			if (!filter.andCategories && result.anyCategories == 0) {
+				result.none = true;
+			}
+		}
+		if (!filter.name.empty()) {
+			result.names = nameMatches(filter.name);
+		}
+		result.duplicates = filter.onlyDuplicateNames;
+		result.countHidden = filter.showHidden;
+		return result;
+	}
+
+	std::shared_ptr<const std::vector<uint8>> PatchSnapshot::nameMatches(std::string const &name) const
+	{
+		// Evaluated once per name in the dictionary instead of once per row. A count and the page after it ask for the same name, so keep the last one.
+		// The dictionary only grows, so its size tells if the cached result is complete
+		ScopedLock lock(derivedLock_);
+		if (lastNameMatches_ && lastName_ == name && lastNameDictionarySize_ == names_.values.size()) {
+			return lastNameMatches_;
+		}
+		// The name is plain ASCII (see canEvaluate), so this is the substring match of LIKE '%name%' with its ASCII case folding
+		auto foldAscii = [](char c) { return (c >= 'A' && c <= 'Z') ? (char)(c - 'A' + 'a') : c; };
+		auto matches = std::make_shared<std::vector<uint8>>(names_.values.size(), 0);
+		for (size_t id = 1; id < names_.values.size(); id++) {
+			auto const &value = names_.values[id];
+			auto found = std::search(value.begin(), value.end(), name.begin(), name.end(), [&foldAscii](char a, char b) { return foldAscii(a) == foldAscii(b); });
+			(*matches)[id] = found != value.end() ? 1 : 0;
+		}
+		lastName_ = name;
+		lastNameDictionarySize_ = names_.values.size();
+		lastNameMatches_ = matches;
+		return matches;
+	}
+
+	uint8 PatchSnapshot::matches(Criteria const &c, size_t row) const
+	{
+		// All tests are evaluated and combined without branching, except for the two that need a lookup
+		int64 categories = categories_[row];
+		uint8 match = c.synthAllowed[synth_[row]];
+		match &= (uint8)((flags_[row] & c.flagMask) == c.flagValue);
+		match &= (uint8)(!c.byImport | (import_[row] == c.import));
+		match &= (uint8)(!c.byType | (type_[row] == c.type));
+		match &= (uint8)((c.anyCategories == 0) | ((categories & c.anyCategories) != 0));
+		match &= (uint8)((categories & c.allCategories) == c.allCategories);
+		match &= (uint8)(!c.untagged | (categories == 0));
+		if (match && c.names) {
+			match = (*c.names)[name_[row]];
+		}
+		if (match && c.duplicates) {
+			auto counts = nameCounts_.find(((uint64)synth_[row] << 32) | name_[row]);
+			match = (uint8)(name_[row] != 0 && counts != nameCounts_.end() && (c.countHidden ? counts->second.count : counts->second.visible) > 1);
+		}
+		return match;
+	}
+
+	void PatchSnapshot::parallelFor(size_t count, std::function<void(size_t begin, size_t end)> const &work) const
+	{
+		if (count < kParallelScanRows) {
+			work(0, count);
+			return;
+		}
+		// The scans only read the columns and don't throw. Should a slice fail anyway, the result would be incomplete, so rethrow instead of returning it
+		ParallelJobs slices(pool_);
+		if (!slices.runSlices(count, work)) {
+			throw std::runtime_error("Program error - snapshot scan failed: " + slices.error());
+		}
+	}
+
+	std::shared_ptr<const std::vector<uint32>> PatchSnapshot::ordering(PatchOrdering orderBy) const
+	{
+		// Sorted once and then reused by every query until the next write. The ranks of the dictionary values replace string compares while sorting
+		ScopedLock lock(derivedLock_);
+		auto &cached = orderBy == PatchOrdering::Order_by_Name ? byName_ : byImport_;
+		if (cached) {
+			return cached;
+		}
+		Dictionary const &dictionary = orderBy == PatchOrdering::Order_by_Name ? names_ : imports_;
+		std::vector<uint32> const &column = orderBy == PatchOrdering::Order_by_Name ? name_ : import_;
+		// NULL is id 0 and sorts first, like in SQLite
+		std::vector<uint32> byValue(dictionary.values.size());
+		std::iota(byValue.begin(), byValue.end(), 0);
+		std::sort(byValue.begin() + 1, byValue.end(), [&dictionary](uint32 a, uint32 b) { return dictionary.values[a] < dictionary.values[b]; });
+		std::vector<uint32> rank(dictionary.values.size());
+		for (size_t i = 0; i < byValue.size(); i++) {
+			rank[byValue[i]] = (uint32)i;
+		}
+		auto order = std::make_shared<std::vector<uint32>>(rowid_.size());
+		std::iota(order->begin(), order->end(), 0);
+		std::sort(order->begin(), order->end(), [&](uint32 a, uint32 b) {
+			if (rank[column[a]] != rank[column[b]]) return rank[column[a]] < rank[column[b]];
+			if (bank_[a] != bank_[b]) return bank_[a] < bank_[b];
+			if (program_[a] != program_[b]) return program_[a] < program_[b];
+			return rowid_[a] < rowid_[b];
+		});
+		cached = order;
+		return order;
+	}
+
+	int PatchSnapshot::count(PatchFilter const &filter, CategoryBitfield const &bitfield) const
+	{
+		ScopedReadLock lock(lock_);
+		auto c = criteria(filter, bitfield);
+		if (c.none) {
+			return 0;
+		}
+		std::atomic<size_t> total{ 0 };
+		parallelFor(rowid_.size(), [this, &c, &total](size_t begin, size_t end) {
+			size_t sum = 0;
+			for (size_t row = begin; row < end; row++) {
+				sum += matches(c, row);
+			}
+			total += sum;
+		});
+		return (int)total.load();
+	}
+
+	std::vector<int64> PatchSnapshot::ids(PatchFilter const &filter, CategoryBitfield const &bitfield, int skip, int limit) const
+	{
+		ScopedReadLock lock(lock_);
+		std::vector<int64> result;
+		auto c = criteria(filter, bitfield);
+		if (c.none || limit == 0) {
+			return result;
+		}
+		std::vector<uint8> selected(rowid_.size());
+		parallelFor(rowid_.size(), [this, &c, &selected](size_t begin, size_t end) {
+			for (size_t row = begin; row < end; row++) {
+				selected[row] = matches(c, row);
+			}
+		});
+
+		// Walk the rows in the order requested, and pick the page
+		size_t first = (size_t)std::max(0, skip);
+		size_t wanted = limit < 0 ? rowid_.size() : (size_t)limit;
+		size_t seen = 0;
+		auto take = [&](size_t row) {
+			if (!selected[row]) return true;
+			if (seen++ >= first) {
+				result.push_back(rowid_[row]);
+			}
+			return result.size() < wanted;
+		};
+		if (filter.orderBy == PatchOrdering::No_ordering) {
+			for (size_t row = 0; row < rowid_.size() && take(row); row++);
+		}
+		else {
+			auto order = ordering(filter.orderBy);
+			for (size_t i = 0; i < order->size() && take((*order)[i]); i++);
+		}
+		return result;
+	}
+
+}
@@ -0,0 +1,100 @@
+/*
+   Copyright (c) 2021 Christof Ruch. All rights reserved.
+
+   Dual licensed: Distributed under Affero GPL license by default, an MIT license is available for purchase
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+
+#include "PatchFilter.h"
+#include "CategoryBitfield.h"
+
+#include "SQLiteCpp/Database.h"
+#include "SQLiteCpp/Statement.h"
+
+#include <unordered_map>
+
+namespace midikraft {
+
+	// The metadata of all patches in memory, one array per column and without the BLOBs, so filters can be counted and evaluated without going to SQLite.
+	// Strings are dictionary encoded and the categories are the bitfield of the patches table. A filter is evaluated by plain loops over the arrays,
+	// which the compiler can vectorize, and split over a thread pool for big libraries.
+	// Rows are identified by the rowid of the patches table, which stays stable as long as nobody runs a VACUUM on the database
+	class PatchSnapshot {
+	public:
+		explicit PatchSnapshot(ThreadPool &pool); // The scans of big libraries are split over the pool, which must outlive the snapshot
+		~PatchSnapshot();
+
+		// Replaces the content with all rows of the patches table
+		void load(SQLite::Database &db, bool hasCategoryIndex);
+		// Reads these rows again, rows that don't exist anymore are dropped
+		void refresh(SQLite::Database &db, bool hasCategoryIndex, std::vector<int64> const &rowids);
+
+		// False for what only SQL can answer: lists, categories outside of the bitfield, and names containing LIKE wildcards or non-ASCII characters
+		static bool canEvaluate(PatchFilter const &filter, CategoryBitfield const &bitfield);
+		// Same results as the SQL built from the filter. Ties in the ordering are broken by rowid
+		int count(PatchFilter const &filter, CategoryBitfield const &bitfield) const;
+		std::vector<int64> ids(PatchFilter const &filter, CategoryBitfield const &bitfield, int skip, int limit) const;
+
+		size_t size() const; // Number of patches
+
+	private:
+		struct Criteria;
+		struct Dictionary {
+			Dictionary();
+			uint32 idFor(SQLite::Column const &column); // Adds new values. Id 0 is NULL
+			int64 find(std::string const &value) const; // -1 if not in the dictionary
+
+			std::vector<std::string> values;
+			std::unordered_map<std::string, uint32> ids;
+		};
+		struct NameCount {
+			int count = 0;
+			int visible = 0;
+		};
+
+		Criteria criteria(PatchFilter const &filter, CategoryBitfield const &bitfield) const;
+		uint8 matches(Criteria const &criteria, size_t row) const;
+		void parallelFor(size_t count, std::function<void(size_t begin, size_t end)> const &work) const;
+		std::shared_ptr<const std::vector<uint32>> ordering(PatchOrdering orderBy) const;
+		std::shared_ptr<const std::vector<uint8>> nameMatches(std::string const &name) const;
+
+		static std::string selectColumns(bool hasCategoryIndex);
+		void readRow(SQLite::Statement &query, size_t row);
+		void countName(size_t row, int delta);
+		void clearDerived();
+		void compactIfNeeded();
+
+		// The columns, one entry per row
+		std::vector<int64> rowid_;
+		std::vector<uint16> synth_;
+		std::vector<uint32> import_;
+		std::vector<uint32> name_;
+		std::vector<int32> type_;
+		std::vector<int32> bank_; // -1 for NULL
+		std::vector<int32> program_;
+		std::vector<int64> categories_;
+		std::vector<uint8> flags_;
+
+		std::unordered_map<int64, size_t> rowOfId_;
+		size_t deadRows_;
+		Dictionary synths_;
+		Dictionary imports_;
+		Dictionary names_;
+		std::unordered_map<uint64, NameCount> nameCounts_; // Per synth and name, like the name_counts table for the duplicate name filter
+
+		bool hasCategoryIndex_;
+
+		mutable ReadWriteLock lock_; // Writers replace rows, readers evaluate filters
+		mutable CriticalSection derivedLock_; // The orderings and name matches are built lazily by readers
+		mutable std::shared_ptr<const std::vector<uint32>> byName_;
+		mutable std::shared_ptr<const std::vector<uint32>> byImport_;
+		mutable std::string lastName_;
+		mutable size_t lastNameDictionarySize_;
+		mutable std::shared_ptr<const std::vector<uint8>> lastNameMatches_;
+		ThreadPool &pool_;
+	};
+
+}
@@ -0,0 +1,140 @@
+/*
+   Copyright (c) 2021 Christof Ruch. All rights reserved.
+
+   Dual licensed: Distributed under Affero GPL license by default, an MIT license is available for purchase
+*/
+
+#include "QueryResultCache.h"
+
+namespace midikraft {
+
+	QueryResultCache::QueryResultCache(size_t capacity, size_t patchBudget) : capacity_(capacity), patchBudget_(patchBudget), patches_(0)
+	{
+	}
+
+	bool QueryResultCache::lookupCount(std::string const& filterKey, Generations const& current, int& outCount)
+	{
+		ScopedLock lock(lock_);
+		auto entry = find(countKey(filterKey), current);
+		if (entry) {
+			outCount = entry->count;
+			return true;
+		}
+		return false;
+	}
+
+	void QueryResultCache::storeCount(std::string const& filterKey, bool dependsOnLists, Generations const& computedAt, int count)
+	{
+		ScopedLock lock(lock_);
+		store({ countKey(filterKey), computedAt, dependsOnLists, count, {} });
+	}
+
+	bool QueryResultCache::lookupPatches(std::string const& filterKey, int skip, int limit, Generations const& current, std::vector<PatchHolder>& outPatches)
+	{
+		ScopedLock lock(lock_);
+		auto entry = find(pageKey(filterKey, skip, limit), current);
+		if (entry) {
+			outPatches = entry->patches;
+			return true;
+		}
+		return false;
+	}
+
+	void QueryResultCache::storePatches(std::string const& filterKey, int skip, int limit, bool dependsOnLists, Generations const& computedAt, std::vector<PatchHolder> const& patches)
+	{
+		// A page bigger than a quarter of the budget would push out most other entries
+		if (patches.size() > patchBudget_ / 4) {
+			return;
+		}
+		ScopedLock lock(lock_);
+		store({ pageKey(filterKey, skip, limit), computedAt, dependsOnLists, 0, patches });
+	}
+
+	void QueryResultCache::clear()
+	{
+		ScopedLock lock(lock_);
+		lru_.clear();
+		index_.clear();
+		patches_ = 0;
+	}
+
+	void QueryResultCache::setCapacity(size_t capacity)
+	{
+		ScopedLock lock(lock_);
+		capacity_ = capacity;
+		evictToCapacity();
+	}
+
+	QueryCacheStats QueryResultCache::stats() const
+	{
+		ScopedLock lock(lock_);
+		QueryCacheStats result = stats_;
+		result.entries = lru_.size();
+		result.capacity = capacity_;
+		result.patches = patches_;
+		result.patchBudget = patchBudget_;
+		return result;
+	}
+
+	QueryResultCache::Entry* QueryResultCache::find(std::string const& key, Generations const& current)
+	{
+		auto found = index_.find(key);
+		if (found == index_.end()) {
+			stats_.misses++;
+			return nullptr;
+		}
+		auto entry = found->second;
+		if (entry->computedAt.patches != current.patches || (entry->dependsOnLists && entry->computedAt.lists != current.lists)) {
+			// Stale, there has been a write since this was computed
+			erase(entry);
+			stats_.misses++;
+			return nullptr;
+		}
+		lru_.splice(lru_.begin(), lru_, entry);
+		stats_.hits++;
+		return &*entry;
+	}
+
+	void QueryResultCache::store(Entry&& entry)
+	{
+		if (capacity_ == 0) return;
+		auto existing = index_.find(entry.key);
+		if (existing != index_.end()) {
+			// Never replace a newer result with one from a query that was started earlier
+			if (existing->second->computedAt.patches > entry.computedAt.patches || existing->second->computedAt.lists > entry.computedAt.lists) {
+				return;
+			}
+			erase(existing->second);
+		}
+		patches_ += entry.patches.size();
+		lru_.push_front(std::move(entry));
+		index_[lru_.front().key] = lru_.begin();
+		evictToCapacity();
+	}
+
+	void QueryResultCache::erase(std::list<Entry>::iterator entry)
+	{
+		patches_ -= entry->patches.size();
+		index_.erase(entry->key);
+		lru_.erase(entry);
+	}
+
+	void QueryResultCache::evictToCapacity()
+	{
+		while (!lru_.empty() && (lru_.size() > capacity_ || patches_ > patchBudget_)) {
+			erase(std::prev(lru_.end()));
+			stats_.evictions++;
+		}
+	}
+
+	std::string QueryResultCache::countKey(std::string const& filterKey)
+	{
+		return "count|" + filterKey;
+	}
+
+	std::string QueryResultCache::pageKey(std::string const& filterKey, int skip, int limit)
+	{
+		return "page|" + std::to_string(skip) + "|" + std::to_string(limit) + "|" + filterKey;
+	}
+
+}
@@ -0,0 +1,76 @@
+/*
+   Copyright (c) 2021 Christof Ruch. All rights reserved.
+
+   Dual licensed: Distributed under Affero GPL license by default, an MIT license is available for purchase
+*/
+
+#pragma once
+
+#include "PatchHolder.h"
+
+#include <list>
+#include <unordered_map>
+
+namespace midikraft {
+
+	struct QueryCacheStats {
+		uint64 hits = 0;
+		uint64 misses = 0; // Includes lookups that found an entry invalidated by a write
+		uint64 evictions = 0;
+		size_t entries = 0;
+		size_t capacity = 0;
+		size_t patches = 0; // Held by the cached pages
+		size_t patchBudget = 0;
+	};
+
+	// LRU cache for the results of getPatchesCount and getPatches, keyed by the canonical filter key plus skip and limit.
+	// Entries are stamped with the write generations they were computed at, so a write only needs to bump a counter instead of walking the cache.
+	// Patch generation changes invalidate everything, list generation changes only the entries of filters that look at a list.
+	// Besides the number of entries, the number of patches held is limited, as every page keeps its patches with their data alive.
+	// The PatchHolders handed out share their patches with the cache, so callers must not modify them
+	class QueryResultCache {
+	public:
+		struct Generations {
+			uint64 patches;
+			uint64 lists;
+		};
+
+		QueryResultCache(size_t capacity, size_t patchBudget);
+
+		bool lookupCount(std::string const& filterKey, Generations const& current, int& outCount);
+		void storeCount(std::string const& filterKey, bool dependsOnLists, Generations const& computedAt, int count);
+
+		bool lookupPatches(std::string const& filterKey, int skip, int limit, Generations const& current, std::vector<PatchHolder>& outPatches);
+		void storePatches(std::string const& filterKey, int skip, int limit, bool dependsOnLists, Generations const& computedAt, std::vector<PatchHolder> const& patches);
+
+		void clear();
+		void setCapacity(size_t capacity);
+		QueryCacheStats stats() const;
+
+	private:
+		struct Entry {
+			std::string key;
+			Generations computedAt;
+			bool dependsOnLists;
+			int count;
+			std::vector<PatchHolder> patches;
+		};
+
+		Entry* find(std::string const& key, Generations const& current);
+		void store(Entry&& entry);
+		void erase(std::list<Entry>::iterator entry);
+		void evictToCapacity();
+
+		static std::string countKey(std::string const& filterKey);
+		static std::string pageKey(std::string const& filterKey, int skip, int limit);
+
+		size_t capacity_;
+		size_t patchBudget_;
+		size_t patches_; // Sum of the patches of all entries
+		std::list<Entry> lru_; // Most recently used first
+		std::unordered_map<std::string, std::list<Entry>::iterator> index_;
+		QueryCacheStats stats_;
+		CriticalSection lock_;
+	};
+
+}
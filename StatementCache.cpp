@@ -0,0 +1,85 @@
+/*
+   Copyright (c) 2021 Christof Ruch. All rights reserved.
+
+   Dual licensed: Distributed under Affero GPL license by default, an MIT license is available for purchase
+*/
+
+#include "StatementCache.h"
+
+namespace midikraft {
+
+	StatementCache::CachedStatement::CachedStatement(StatementCache* cache, std::string const& sql, std::unique_ptr<SQLite::Statement> statement) :
+		cache_(cache), sql_(sql), statement_(std::move(statement))
+	{
+	}
+
+	StatementCache::CachedStatement::CachedStatement(CachedStatement&& other) noexcept :
+		cache_(other.cache_), sql_(std::move(other.sql_)), statement_(std::move(other.statement_))
+	{
+		other.cache_ = nullptr;
+	}
+
+	StatementCache::CachedStatement::~CachedStatement()
+	{
+		if (cache_ && statement_) {
+			cache_->giveBack(sql_, std::move(statement_));
+		}
+	}
+
+	StatementCache::StatementCache(SQLite::Database& db, size_t capacity) : db_(db), capacity_(capacity)
+	{
+	}
+
+	StatementCache::CachedStatement StatementCache::prepare(std::string const& sql)
+	{
+		{
+			ScopedLock lock(lock_);
+			auto found = index_.find(sql);
+			if (found != index_.end()) {
+				auto entry = found->second;
+				auto statement = std::move(entry->second);
+				index_.erase(found);
+				idle_.erase(entry);
+				return CachedStatement(this, sql, std::move(statement));
+			}
+		}
+		// Compile outside of the lock, this is the expensive part
+		return CachedStatement(this, sql, std::make_unique<SQLite::Statement>(db_, sql));
+	}
+
+	void StatementCache::clear()
+	{
+		ScopedLock lock(lock_);
+		index_.clear();
+		idle_.clear();
+	}
+
+	void StatementCache::giveBack(std::string const& sql, std::unique_ptr<SQLite::Statement> statement)
+	{
+		try {
+			// Reset also releases the read lock an unfinished SELECT holds
+			statement->reset();
+			statement->clearBindings();
+		}
+		catch (SQLite::Exception&) {
+			// reset() reports the error of the last step again. The statement itself is still fine, but don't take chances with it
+			return;
+		}
+		ScopedLock lock(lock_);
+		if (capacity_ == 0) return;
+		idle_.emplace_front(sql, std::move(statement));
+		index_.emplace(sql, idle_.begin());
+		while (idle_.size() > capacity_) {
+			auto last = std::prev(idle_.end());
+			auto range = index_.equal_range(last->first);
+			for (auto it = range.first; it != range.second; it++) {
+				if (it->second == last) {
+					index_.erase(it);
+					break;
+				}
+			}
+			idle_.pop_back();
+		}
+	}
+
+}
@@ -0,0 +1,65 @@
+/*
+   Copyright (c) 2021 Christof Ruch. All rights reserved.
+
+   Dual licensed: Distributed under Affero GPL license by default, an MIT license is available for purchase
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+
+#include "SQLiteCpp/Database.h"
+#include "SQLiteCpp/Statement.h"
+
+#include <list>
+#include <memory>
+#include <unordered_map>
+
+namespace midikraft {
+
+	// Keeps prepared statements of one connection around, keyed by their SQL text, so queries built again and again 
+	// (like the ones generated from a PatchFilter) are parsed and planned only once.
+	// A statement is checked out for exclusive use and returned reset and with cleared bindings when the CachedStatement goes out of scope.
+	// If the same SQL is needed while checked out, e.g. by a second thread on the same connection, a fresh statement is prepared.
+	// The cache must be destroyed before its database.
+	class StatementCache {
+	public:
+		class CachedStatement {
+		public:
+			CachedStatement(CachedStatement&& other) noexcept;
+			CachedStatement(CachedStatement const&) = delete;
+			CachedStatement& operator=(CachedStatement const&) = delete;
+			~CachedStatement();
+
+			SQLite::Statement& operator*() { return *statement_; }
+			SQLite::Statement* operator->() { return statement_.get(); }
+
+		private:
+			friend class StatementCache;
+			CachedStatement(StatementCache* cache, std::string const& sql, std::unique_ptr<SQLite::Statement> statement);
+
+			StatementCache* cache_;
+			std::string sql_;
+			std::unique_ptr<SQLite::Statement> statement_;
+		};
+
+		StatementCache(SQLite::Database& db, size_t capacity);
+
+		// Throws SQLite::Exception like the SQLite::Statement constructor if the SQL doesn't compile
+		CachedStatement prepare(std::string const& sql);
+
+		void clear();
+
+	private:
+		void giveBack(std::string const& sql, std::unique_ptr<SQLite::Statement> statement);
+
+		typedef std::list<std::pair<std::string, std::unique_ptr<SQLite::Statement>>> IdleList;
+
+		SQLite::Database& db_;
+		size_t capacity_;
+		IdleList idle_; // Most recently returned first
+		std::unordered_multimap<std::string, IdleList::iterator> index_;
+		CriticalSection lock_;
+	};
+
+}
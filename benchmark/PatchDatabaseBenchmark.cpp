@@ -0,0 +1,285 @@
+/*
+   Copyright (c) 2021 Christof Ruch. All rights reserved.
+
+   Dual licensed: Distributed under Affero GPL license by default, an MIT license is available for purchase
+*/
+
+#include "PatchDatabase.h"
+#include "SyntheticLibrary.h"
+
+#include "fmt/format.h"
+
+#include <algorithm>
+#include <iostream>
+#include <set>
+
+// Benchmarks the hot paths of the PatchDatabase on synthetic libraries of different sizes, and writes the timings as JSON.
+//
+//   midikraft-database-benchmark [--sizes=10000,100000,1000000] [--iterations=5] [--directory=<dir>] [--reuse] [--output=<file>] [--snapshot]
+//
+// The databases are generated into the directory given, by default the temp directory. With --reuse a database generated before
+// by the same generator version is used again instead of being generated, which skips the (timed) initial merge.
+// With --snapshot the database is opened with the columnar snapshot, to compare it with the SQL queries
+namespace {
+
+	using namespace midikraft;
+
+	const int kResultFormatVersion = 1;
+	const int kGenerateChunkSize = 5000;
+	const int kNumberOfLists = 50;
+	const int kPageSize = 100;
+	const int kKeysetWalkRows = 20000;
+	const int kMergeChunk = 1000;
+
+	struct Timing {
+		std::vector<double> milliseconds;
+		int64 rows = 0; // Rows returned or written by one iteration
+
+		double median() const {
+			auto sorted = milliseconds;
+			std::sort(sorted.begin(), sorted.end());
+			return sorted.empty() ? 0.0 : sorted[sorted.size() / 2];
+		}
+	};
+
+	class BenchmarkRun {
+	public:
+		BenchmarkRun(int iterations) : iterations_(iterations) {
+		}
+
+		template<typename TWork> void measure(int size, std::string const &name, TWork work, int iterations = -1) {
+			Timing timing;
+			for (int i = 0; i < (iterations < 0 ? iterations_ : iterations); i++) {
+				double start = Time::getMillisecondCounterHiRes();
+				timing.rows = (int64)work();
+				timing.milliseconds.push_back(Time::getMillisecondCounterHiRes() - start);
+			}
+			record(size, name, timing);
+		}
+
+		void record(int size, std::string const &name, Timing const &timing) {
+			DynamicObject::Ptr entry = new DynamicObject();
+			entry->setProperty("size", size);
+			entry->setProperty("benchmark", String(name));
+			entry->setProperty("iterations", (int)timing.milliseconds.size());
+			entry->setProperty("rows", timing.rows);
+			entry->setProperty("minMs", *std::min_element(timing.milliseconds.begin(), timing.milliseconds.end()));
+			entry->setProperty("medianMs", timing.median());
+			entry->setProperty("maxMs", *std::max_element(timing.milliseconds.begin(), timing.milliseconds.end()));
+			if (timing.rows > 0 && timing.median() > 0.0) {
+				entry->setProperty("rowsPerSecond", timing.rows * 1000.0 / timing.median());
+			}
+			results_.add(var(entry.get()));
+			// Progress goes to stderr, stdout carries the JSON when there is no --output
+			std::cerr << fmt::format("{:>8} {:<40} {:>10.2f} ms median {:>10} rows", size, name, timing.median(), timing.rows) << std::endl;
+		}
+
+		var toJson(Array<var> const &sizes, int64 seed, bool snapshot) const {
+			DynamicObject::Ptr machine = new DynamicObject();
+			machine->setProperty("os", SystemStats::getOperatingSystemName());
+			machine->setProperty("cpu", SystemStats::getCpuModel());
+			machine->setProperty("cores", SystemStats::getNumCpuCores());
+			machine->setProperty("memoryMB", SystemStats::getMemorySizeInMegabytes());
+
+			DynamicObject::Ptr root = new DynamicObject();
+			root->setProperty("format", "midikraft-database-benchmark");
+			root->setProperty("version", kResultFormatVersion);
+			root->setProperty("generatorVersion", SyntheticLibrary::kGeneratorVersion);
+			root->setProperty("seed", seed);
+			root->setProperty("timestamp", Time::getCurrentTime().toISO8601(true));
+			root->setProperty("iterations", iterations_);
+			root->setProperty("snapshot", snapshot);
+			root->setProperty("sizes", sizes);
+			root->setProperty("machine", var(machine.get()));
+			root->setProperty("results", results_);
+			return var(root.get());
+		}
+
+	private:
+		int iterations_;
+		Array<var> results_;
+	};
+
+	File databaseFileFor(File directory, int size) {
+		return directory.getChildFile(fmt::format("benchmark_{}_v{}.db3", size, SyntheticLibrary::kGeneratorVersion));
+	}
+
+	void runSize(BenchmarkRun &run, File directory, int size, bool reuse, bool snapshot) {
+		File file = databaseFileFor(directory, size);
+		bool generate = !(reuse && file.existsAsFile());
+		if (generate) {
+			file.deleteFile();
+		}
+		DatabaseOpenOptions options;
+		options.columnarSnapshot = snapshot;
+		PatchDatabase db(file.getFullPathName().toStdString(), PatchDatabase::OpenMode::READ_WRITE_NO_BACKUPS, options);
+		// Measure the queries, not the result cache
+		db.setQueryCacheSize(0);
+
+		SyntheticLibrary library(size, db.getCategories());
+		auto allPatches = PatchDatabase::allPatchesFilter(library.synths());
+		allPatches.showHidden = true;
+		auto lists = library.lists(kNumberOfLists);
+
+		if (generate) {
+			Timing timing;
+			double start = Time::getMillisecondCounterHiRes();
+			for (int first = 0; first < size; first += kGenerateChunkSize) {
+				auto patches = library.generate(first, kGenerateChunkSize);
+				std::vector<PatchHolder> newPatches;
+				timing.rows += (int64)db.mergePatchesIntoDatabase(patches, newPatches, nullptr, PatchDatabase::UPDATE_ALL);
+			}
+			timing.milliseconds.push_back(Time::getMillisecondCounterHiRes() - start);
+			run.record(size, "mergePatchesIntoDatabase/new", timing);
+
+			run.measure(size, "putPatchList/all", [&db, &lists]() {
+				for (auto const &list : lists) {
+					db.putPatchList(list);
+				}
+				return lists.size();
+			}, 1);
+		}
+
+		// Counts
+		run.measure(size, "getPatchesCount/all", [&]() { return db.getPatchesCount(allPatches); });
+		auto byCategory = allPatches;
+		if (!db.getCategories().empty()) {
+			byCategory.categories.insert(db.getCategories().front());
+		}
+		run.measure(size, "getPatchesCount/category", [&]() { return db.getPatchesCount(byCategory); });
+		auto byName = allPatches;
+		byName.name = "pad";
+		run.measure(size, "getPatchesCount/name", [&]() { return db.getPatchesCount(byName); });
+		auto byImport = PatchDatabase::allForSynth(library.synthOfImport(library.largestImport()));
+		byImport.importID = library.sourceOfImport(library.largestImport(), 0)->md5(library.synthOfImport(library.largestImport()));
+		run.measure(size, "getPatchesCount/import", [&]() { return db.getPatchesCount(byImport); });
+		auto duplicates = allPatches;
+		duplicates.onlyDuplicateNames = true;
+		run.measure(size, "getPatchesCount/duplicateNames", [&]() { return db.getPatchesCount(duplicates); });
+
+		// Pages
+		auto byNameOrder = allPatches;
+		byNameOrder.orderBy = PatchOrdering::Order_by_Name;
+		run.measure(size, "getPatches/firstPage", [&]() { return db.getPatches(byNameOrder, 0, kPageSize).size(); });
+		run.measure(size, "getPatches/lastPageOffset", [&]() { return db.getPatches(byNameOrder, std::max(0, size - kPageSize), kPageSize).size(); });
+		run.measure(size, "getPatches/keysetWalk", [&]() {
+			PatchPageToken page;
+			size_t rows = 0;
+			while (!page.endReached && rows < (size_t)kKeysetWalkRows) {
+				rows += db.getPatches(byNameOrder, page, 500).size();
+			}
+			return rows;
+		});
+		run.measure(size, "getPatches/category", [&]() { return db.getPatches(byCategory, 0, 1000).size(); });
+		run.measure(size, "getPatchesMetaData/firstPage", [&]() { return db.getPatchesMetaData(byNameOrder, 0, kPageSize).size(); });
+
+		// Lists
+		auto largestList = *std::max_element(lists.begin(), lists.end(), [](std::shared_ptr<PatchList> const &a, std::shared_ptr<PatchList> const &b) { return a->patches().size() < b->patches().size(); });
+		ListInfo listInfo{ largestList->id(), largestList->name() };
+		run.measure(size, "getPatchList/largest", [&]() { return db.getPatchList(listInfo, library.synthMap())->patches().size(); });
+		int lastIndex = (int)largestList->patches().size() - 1;
+		run.measure(size, "movePatchInList/firstToLastAndBack", [&]() {
+			auto patches = db.getPatchList(listInfo, library.synthMap())->patches();
+			db.movePatchInList(listInfo, patches.front(), 0, lastIndex);
+			db.movePatchInList(listInfo, patches.front(), lastIndex, 0);
+			return 2;
+		});
+
+		// Writes, each iteration leaves the database as it found it. Deleting a patch also drops its list entries, so only patches in no list are deleted and merged again
+		int middle = std::max(0, size / 2 - kMergeChunk / 2);
+		std::set<std::pair<std::string, std::string>> listed;
+		for (auto const &list : lists) {
+			for (auto const &patch : list->patches()) {
+				listed.emplace(patch.synth()->getName(), patch.md5());
+			}
+		}
+		run.measure(size, "mergePatchesIntoDatabase/known", [&]() {
+			auto patches = library.generate(middle, kMergeChunk);
+			std::vector<PatchHolder> newPatches;
+			db.mergePatchesIntoDatabase(patches, newPatches, nullptr, PatchDatabase::UPDATE_ALL);
+			return patches.size();
+		});
+		Timing deletes;
+		for (int i = 0; i < 3; i++) {
+			std::vector<PatchHolder> patches;
+			std::map<std::string, std::vector<std::string>> md5sPerSynth;
+			for (auto const &patch : library.generate(middle, kMergeChunk)) {
+				if (listed.find({ patch.synth()->getName(), patch.md5() }) == listed.end()) {
+					patches.push_back(patch);
+					md5sPerSynth[patch.synth()->getName()].push_back(patch.md5());
+				}
+			}
+			double start = Time::getMillisecondCounterHiRes();
+			deletes.rows = 0;
+			for (auto const &synth : md5sPerSynth) {
+				deletes.rows += db.deletePatches(synth.first, synth.second);
+			}
+			deletes.milliseconds.push_back(Time::getMillisecondCounterHiRes() - start);
+			std::vector<PatchHolder> newPatches;
+			db.mergePatchesIntoDatabase(patches, newPatches, nullptr, PatchDatabase::UPDATE_ALL);
+		}
+		run.record(size, "deletePatches/md5s", deletes);
+		run.measure(size, "reindexPatches/largestImport", [&]() { return db.reindexPatches(byImport); }, 1);
+	}
+
+}
+
+int main(int argc, char *argv[])
+{
+	ScopedJuceInitialiser_GUI juce;
+
+	Array<var> sizes = { 10000, 100000, 1000000 };
+	int iterations = 5;
+	File directory = File::getSpecialLocation(File::tempDirectory);
+	File output;
+	bool reuse = false;
+	bool snapshot = false;
+	for (int i = 1; i < argc; i++) {
+		String argument(argv[i]);
+		if (argument.startsWith("--sizes=")) {
+			sizes.clear();
+			for (auto const &size : StringArray::fromTokens(argument.fromFirstOccurrenceOf("=", false, false), ",", "")) {
+				if (size.getIntValue() > 0) sizes.add(size.getIntValue());
+			}
+		}
+		else if (argument.startsWith("--iterations=")) {
+			iterations = std::max(1, argument.fromFirstOccurrenceOf("=", false, false).getIntValue());
+		}
+		else if (argument.startsWith("--directory=")) {
+			directory = File(argument.fromFirstOccurrenceOf("=", false, false));
+		}
+		else if (argument.startsWith("--output=")) {
+			output = File(argument.fromFirstOccurrenceOf("=", false, false));
+		}
+		else if (argument == "--reuse") {
+			reuse = true;
+		}
+		else if (argument == "--snapshot") {
+			snapshot = true;
+		}
+		else {
+			std::cerr << "Unknown argument " << argument << std::endl
+				<< "Usage: midikraft-database-benchmark [--sizes=10000,100000,1000000] [--iterations=5] [--directory=<dir>] [--reuse] [--output=<file>] [--snapshot]" << std::endl;
+			return 1;
+		}
+	}
+	if (!directory.createDirectory()) {
+		std::cerr << "Cannot create directory " << directory.getFullPathName() << std::endl;
+		return 1;
+	}
+
+	BenchmarkRun run(iterations);
+	for (auto const &size : sizes) {
+		runSize(run, directory, (int)size, reuse, snapshot);
+	}
+
+	String json = JSON::toString(run.toJson(sizes, SyntheticLibrary::kDefaultSeed, snapshot));
+	if (output == File()) {
+		std::cout << json << std::endl;
+	}
+	else if (!output.replaceWithText(json)) {
+		std::cerr << "Failed to write " << output.getFullPathName() << std::endl;
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,202 @@
+/*
+   Copyright (c) 2021 Christof Ruch. All rights reserved.
+
+   Dual licensed: Distributed under Affero GPL license by default, an MIT license is available for purchase
+*/
+
+#include "SyntheticLibrary.h"
+
+#include "fmt/format.h"
+
+#include <algorithm>
+
+namespace midikraft {
+
+	const int kPatchesPerBank = 128;
+
+	const char *kSyntheticSynths[] = { "Synthetic Poly", "Synthetic Mono", "Synthetic Rompler", "Synthetic Modular" };
+	// Share of the imports each synth gets, in percent
+	const int kSynthPopularity[] = { 50, 25, 15, 10 };
+
+	const char *kAdjectives[] = { "Warm", "Dark", "Bright", "Fat", "Thin", "Analog", "Glass", "Deep", "Soft", "Hard", "Wide", "Dirty", "Clean", "Slow", "Fast", "Old" };
+	const char *kNouns[] = { "Pad", "Lead", "Bass", "Brass", "Strings", "Keys", "Bell", "Sweep", "Pluck", "Choir", "Organ", "Drone", "Arp", "Hit", "Noise", "Sync" };
+
+	SyntheticSynth::SyntheticSynth(std::string const &name, int numberOfBanks) : name_(name), numberOfBanks_(numberOfBanks)
+	{
+	}
+
+	std::string SyntheticSynth::getName() const
+	{
+		return name_;
+	}
+
+	std::shared_ptr<DataFile> SyntheticSynth::patchFromPatchData(const Synth::PatchData &data, MidiProgramNumber place) const
+	{
+		ignoreUnused(place);
+		return std::make_shared<SyntheticPatch>(data);
+	}
+
+	bool SyntheticSynth::isOwnSysex(MidiMessage const &message) const
+	{
+		ignoreUnused(message);
+		return false;
+	}
+
+	int SyntheticSynth::numberOfBanks() const
+	{
+		return numberOfBanks_;
+	}
+
+	int SyntheticSynth::numberOfPatches() const
+	{
+		return kPatchesPerBank;
+	}
+
+	std::string SyntheticSynth::friendlyBankName(MidiBankNumber bankNo) const
+	{
+		return fmt::format("Bank {}", bankNo.toZeroBased() + 1);
+	}
+
+	SyntheticPatch::SyntheticPatch(Synth::PatchData const &data) : Patch(0, data)
+	{
+	}
+
+	SyntheticLibrary::SyntheticLibrary(int numberOfPatches, std::vector<Category> const &categories, int64 seed) :
+		numberOfPatches_(numberOfPatches), seed_(seed), categories_(categories)
+	{
+		for (auto name : kSyntheticSynths) {
+			synths_.push_back(std::make_shared<SyntheticSynth>(name, 8));
+		}
+
+		// 70% single files of up to 32 patches, 25% full banks, 5% archives of 1000 to 5000 patches
+		Random random(seed_);
+		int first = 0;
+		while (first < numberOfPatches_) {
+			int kind = random.nextInt(100);
+			int count;
+			if (kind < 70) {
+				count = 1 + random.nextInt(32);
+			}
+			else if (kind < 95) {
+				count = kPatchesPerBank;
+			}
+			else {
+				count = 1000 + random.nextInt(4001);
+			}
+			count = std::min(count, numberOfPatches_ - first);
+			int popularity = random.nextInt(100);
+			int synth = 0;
+			for (int sum = kSynthPopularity[0]; popularity >= sum; sum += kSynthPopularity[++synth]);
+			imports_.push_back({ first, count, synth });
+			first += count;
+		}
+	}
+
+	std::map<std::string, std::weak_ptr<Synth>> SyntheticLibrary::synthMap() const
+	{
+		std::map<std::string, std::weak_ptr<Synth>> result;
+		for (auto const &synth : synths_) {
+			result.emplace(synth->getName(), synth);
+		}
+		return result;
+	}
+
+	int SyntheticLibrary::importOfPatch(int index) const
+	{
+		auto import = std::upper_bound(imports_.begin(), imports_.end(), index, [](int i, Import const &import) { return i < import.first; });
+		return (int)(import - imports_.begin()) - 1;
+	}
+
+	std::shared_ptr<Synth> SyntheticLibrary::synthOfImport(int import) const
+	{
+		return synths_[imports_[import].synth];
+	}
+
+	std::shared_ptr<SourceInfo> SyntheticLibrary::sourceOfImport(int import, int programInImport) const
+	{
+		auto fileName = fmt::format("synthetic_import_{}.syx", import);
+		return std::make_shared<FromFileSource>(fileName, "/synthetic/" + fileName, MidiProgramNumber::fromZeroBase(programInImport % kPatchesPerBank));
+	}
+
+	int SyntheticLibrary::largestImport() const
+	{
+		return (int)(std::max_element(imports_.begin(), imports_.end(), [](Import const &a, Import const &b) { return a.count < b.count; }) - imports_.begin());
+	}
+
+	PatchHolder SyntheticLibrary::patch(int index) const
+	{
+		// Every patch has its own generator, so it doesn't depend on the patches generated before it
+		Random random(seed_ * 1000003 + index);
+		int import = importOfPatch(index);
+		int position = index - imports_[import].first;
+		auto synth = synthOfImport(import);
+
+		// The index in front makes the md5 unique
+		Synth::PatchData data(256 + 64 * random.nextInt(4));
+		for (int i = 0; i < 4; i++) {
+			data[i] = (uint8)((index >> (8 * i)) & 0xff);
+		}
+		for (size_t i = 4; i < data.size(); i++) {
+			data[i] = (uint8)random.nextInt(128);
+		}
+
+		MidiProgramNumber program = MidiProgramNumber::fromZeroBase(position % kPatchesPerBank);
+		MidiBankNumber bank = MidiBankNumber::fromZeroBase((position / kPatchesPerBank) % synth->numberOfBanks(), kPatchesPerBank);
+		PatchHolder holder(synth, sourceOfImport(import, position), std::make_shared<SyntheticPatch>(data), bank, program);
+
+		// 256 names plus a number out of 100 gives enough repeats for the duplicate name filter
+		std::string name = std::string(kAdjectives[random.nextInt(16)]) + " " + kNouns[random.nextInt(16)];
+		if (random.nextInt(4) != 0) {
+			name += fmt::format(" {}", random.nextInt(100));
+		}
+		holder.setName(name);
+
+		// Up to three categories, squaring the random number prefers the first categories of the list
+		if (!categories_.empty()) {
+			int draw = random.nextInt(100);
+			int numberOfCategories = draw < 30 ? 0 : (draw < 75 ? 1 : (draw < 95 ? 2 : 3));
+			std::set<Category> categories;
+			for (int i = 0; i < numberOfCategories; i++) {
+				double r = random.nextDouble();
+				categories.insert(categories_[std::min(categories_.size() - 1, (size_t)(r * r * categories_.size()))]);
+			}
+			holder.setCategories(categories);
+		}
+		holder.setFavorite(Favorite(random.nextInt(100) < 5));
+		holder.setHidden(random.nextInt(100) < 2);
+		return holder;
+	}
+
+	std::vector<PatchHolder> SyntheticLibrary::generate(int first, int count) const
+	{
+		std::vector<PatchHolder> result;
+		count = std::max(0, std::min(count, numberOfPatches_ - first));
+		result.reserve((size_t)count);
+		for (int i = first; i < first + count; i++) {
+			result.push_back(patch(i));
+		}
+		return result;
+	}
+
+	std::vector<std::shared_ptr<PatchList>> SyntheticLibrary::lists(int numberOfLists) const
+	{
+		std::vector<std::shared_ptr<PatchList>> result;
+		Random random(seed_ + 17);
+		for (int l = 0; l < numberOfLists; l++) {
+			auto list = std::make_shared<PatchList>(fmt::format("synthetic-list-{}", l), fmt::format("Synthetic list {}", l + 1));
+			int size = 20 + random.nextInt(481);
+			std::vector<PatchHolder> patches;
+			std::set<int> used;
+			for (int i = 0; i < size && (int)used.size() < numberOfPatches_; i++) {
+				int index = random.nextInt(numberOfPatches_);
+				if (used.insert(index).second) {
+					patches.push_back(patch(index));
+				}
+			}
+			list->setPatches(patches);
+			result.push_back(list);
+		}
+		return result;
+	}
+
+}
@@ -0,0 +1,81 @@
+/*
+   Copyright (c) 2021 Christof Ruch. All rights reserved.
+
+   Dual licensed: Distributed under Affero GPL license by default, an MIT license is available for purchase
+*/
+
+#pragma once
+
+#include "Synth.h"
+#include "Patch.h"
+#include "PatchHolder.h"
+#include "PatchList.h"
+#include "Category.h"
+
+namespace midikraft {
+
+	// A synth that only stores its patches, so the benchmark measures the database and not the sysex parsing of a real synth
+	class SyntheticSynth : public Synth {
+	public:
+		SyntheticSynth(std::string const &name, int numberOfBanks);
+
+		std::string getName() const override;
+		std::shared_ptr<DataFile> patchFromPatchData(const Synth::PatchData &data, MidiProgramNumber place) const override;
+		bool isOwnSysex(MidiMessage const &message) const override;
+		int numberOfBanks() const override;
+		int numberOfPatches() const override;
+		std::string friendlyBankName(MidiBankNumber bankNo) const override;
+
+	private:
+		std::string name_;
+		int numberOfBanks_;
+	};
+
+	class SyntheticPatch : public Patch {
+	public:
+		SyntheticPatch(Synth::PatchData const &data);
+	};
+
+	// Generates a library that looks like a real one: most imports are single files or banks of 128, a few are big archives,
+	// synths are unevenly popular, a few categories are common and most are rare, and some names repeat.
+	// Patch i is the same for the same seed and category list, no matter in which chunks the library is generated
+	class SyntheticLibrary {
+	public:
+		static const int kGeneratorVersion = 1; // Increase when the generated library changes, so results are only compared for the same content
+		static const int64 kDefaultSeed = 4711;
+
+		SyntheticLibrary(int numberOfPatches, std::vector<Category> const &categories, int64 seed = kDefaultSeed);
+
+		std::vector<std::shared_ptr<Synth>> const &synths() const { return synths_; }
+		std::map<std::string, std::weak_ptr<Synth>> synthMap() const;
+		int numberOfPatches() const { return numberOfPatches_; }
+		int numberOfImports() const { return (int)imports_.size(); }
+		int64 seed() const { return seed_; }
+
+		std::vector<PatchHolder> generate(int first, int count) const;
+		PatchHolder patch(int index) const;
+
+		// User lists of 20 to 500 patches, each patch drawn from the whole library
+		std::vector<std::shared_ptr<PatchList>> lists(int numberOfLists) const;
+
+		// The import with the most patches, and its synth
+		int largestImport() const;
+		std::shared_ptr<Synth> synthOfImport(int import) const;
+		std::shared_ptr<SourceInfo> sourceOfImport(int import, int programInImport) const;
+
+	private:
+		struct Import {
+			int first; // Index of the first patch
+			int count;
+			int synth;
+		};
+		int importOfPatch(int index) const;
+
+		int numberOfPatches_;
+		int64 seed_;
+		std::vector<Category> categories_;
+		std::vector<std::shared_ptr<Synth>> synths_;
+		std::vector<Import> imports_;
+	};
+
+}